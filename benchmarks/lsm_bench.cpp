@@ -1,6 +1,11 @@
 #include "db.hpp"
+#include "write_batch.hpp"
 #include <benchmark/benchmark.h>
+#include <algorithm>
 #include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>
 
 static void BM_WriteThroughput(benchmark::State& state) {
     std::filesystem::remove_all("bench_data");
@@ -34,7 +39,109 @@ static void BM_ReadThroughput(benchmark::State& state) {
     state.SetItemsProcessed(state.iterations() * 200000);
 }
 
+// Shared by all threads of BM_ConcurrentWrite; thread 0 sets up and tears down
+// (the benchmark loop has a barrier on entry and exit).
+static std::unique_ptr<HeliosDB> g_db;
+
+static void BM_ConcurrentWrite(benchmark::State& state) {
+    if (state.thread_index() == 0) {
+        std::filesystem::remove_all("bench_data");
+        g_db = std::make_unique<HeliosDB>("bench_data");
+    }
+
+    const std::string prefix = "t" + std::to_string(state.thread_index()) + "_key";
+    int64_t i = 0;
+    for (auto _ : state) {
+        g_db->put(prefix + std::to_string(i), "value" + std::to_string(i));
+        ++i;
+    }
+    state.SetItemsProcessed(state.iterations());
+
+    if (state.thread_index() == 0) {
+        g_db.reset();
+    }
+}
+
+// Point lookups from every thread against one DB (g_db, set up as in
+// BM_ConcurrentWrite). Each get loads the shared read view, so this shows
+// how far reads scale with cores.
+static void BM_ConcurrentRead(benchmark::State& state) {
+    constexpr int kKeys = 200000;
+    if (state.thread_index() == 0) {
+        std::filesystem::remove_all("bench_data");
+        g_db = std::make_unique<HeliosDB>("bench_data");
+        for (int i = 0; i < kKeys; i++) {
+            g_db->put("key" + std::to_string(i), "value" + std::to_string(i));
+        }
+        g_db->flush();
+    }
+
+    int64_t i = state.thread_index() * 7919;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(g_db->get("key" + std::to_string(i % kKeys)));
+        ++i;
+    }
+    state.SetItemsProcessed(state.iterations());
+
+    if (state.thread_index() == 0) {
+        g_db.reset();
+    }
+}
+
+// 1, 2, 4, ... up to the number of hardware threads
+static void ThreadsUpToCores(benchmark::internal::Benchmark* b) {
+    const int cores = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    for (int t = 1; t < cores; t *= 2) b->Threads(t);
+    b->Threads(cores);
+}
+
+// One put per iteration under each WalMode (arg = enum value).
+static void BM_WalMode(benchmark::State& state) {
+    static const char* kNames[] = {"sync", "periodic", "buffered", "disabled"};
+    Options opts;
+    opts.wal_mode = static_cast<WalMode>(state.range(0));
+
+    std::filesystem::remove_all("bench_data");
+    HeliosDB db("bench_data", opts);
+
+    int64_t i = 0;
+    for (auto _ : state) {
+        db.put("key" + std::to_string(i), "value" + std::to_string(i));
+        ++i;
+    }
+
+    state.SetLabel(kNames[state.range(0)]);
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Same load as BM_WriteThroughput, written as batches of state.range(0) keys.
+static void BM_BatchWriteThroughput(benchmark::State& state) {
+    std::filesystem::remove_all("bench_data");
+    HeliosDB db("bench_data");
+    const int batch_size = static_cast<int>(state.range(0));
+
+    WriteBatch batch;
+    for (auto _ : state) {
+        for (int i = 0; i < 100000; i++) {
+            batch.put("key" + std::to_string(i), "value" + std::to_string(i));
+            if (batch.count() == static_cast<size_t>(batch_size)) {
+                db.write(batch);
+                batch.clear();
+            }
+        }
+        db.write(batch);
+        batch.clear();
+        db.flush();
+    }
+
+    state.SetItemsProcessed(state.iterations() * 100000);
+}
+
 BENCHMARK(BM_WriteThroughput);
+BENCHMARK(BM_BatchWriteThroughput)->Arg(100)->Arg(1000);
 BENCHMARK(BM_ReadThroughput);
+BENCHMARK(BM_WalMode)->DenseRange(0, 3)->UseRealTime();
+BENCHMARK(BM_ConcurrentWrite)->Apply(ThreadsUpToCores)->UseRealTime();
+BENCHMARK(BM_ConcurrentRead)->Apply(ThreadsUpToCores)->UseRealTime();
 
 BENCHMARK_MAIN();
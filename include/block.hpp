@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// SSTable data block:
+//   [ksize u32][vsize u32][key][value]   per entry, sorted by key
+//   [entry offset u32] * n
+//   [n u32]
+// vsize == kTombstoneVSize marks a delete (no value bytes). The offset
+// array lets a lookup binary-search the block in memory.
+static constexpr uint32_t kTombstoneVSize = 0xFFFFFFFFu;
+
+class BlockBuilder {
+public:
+    // keys must be added in ascending order
+    void add(const std::string& key, const std::optional<std::string>& value);
+
+    // Returns the finished block and resets the builder.
+    std::string finish();
+
+    size_t size_estimate() const { return rep_.size() + 4 * (offsets_.size() + 1); }
+    bool empty() const { return offsets_.empty(); }
+
+private:
+    std::string rep_;
+    std::vector<uint32_t> offsets_;
+};
+
+class Block {
+public:
+    Block() = default;
+    explicit Block(std::string contents);
+
+    // false if the trailer does not describe a well-formed block
+    bool ok() const { return ok_; }
+    uint32_t num_entries() const { return n_; }
+
+    // Entry i; false if it runs past the entry region.
+    bool entry(uint32_t i, std::string_view& key, std::optional<std::string_view>& value) const;
+
+    // get() returns:
+    // - nullopt => not found in this block
+    // - optional<string> == nullopt => tombstone
+    // - optional<string> == value => found value
+    std::optional<std::optional<std::string>> get(const std::string& key) const;
+
+    // index of the first entry with key >= target (n if none)
+    uint32_t lower_bound(std::string_view target) const;
+
+private:
+    std::string data_;
+    uint32_t n_{0};
+    uint32_t offsets_at_{0}; // start of the offset array == end of entries
+    bool ok_{false};
+
+    std::string_view key_at(uint32_t i) const;
+};
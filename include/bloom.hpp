@@ -1,32 +1,77 @@
 #pragma once
+#include <cstddef>
 #include <cstdint>
+#include <new>
 #include <string>
+#include <string_view>
 #include <vector>
 
+// Blocked Bloom filter: a key's k bits all fall in one 64-byte block, so a
+// probe touches a single cache line. The block is picked by multiply-shift
+// on the high half of the key's key_hash::value() and the bits by remixing
+// the low half, so a lookup can hash the key once for every table.
+//
+// Older filters still decode (the magic records the format) and hash the
+// key themselves: FNV-1a blocked filters, and before them filters with bits
+// spread over the whole array, including .bloom sidecars of v1 tables.
 class BloomFilter {
 public:
     BloomFilter() = default;
 
-    // Create with m bits and k hash functions
+    // Create with m bits (rounded up to whole blocks) and k hash functions
     BloomFilter(uint32_t m_bits, uint32_t k_hashes);
 
     void add(const std::string& key);
+    // hash is key_hash::value(key); for filters made by the constructor,
+    // which all hash that way
+    void add_hash(uint64_t hash);
     bool possibly_contains(const std::string& key) const;
+    // hash is key_hash::value(key)
+    bool possibly_contains(std::string_view key, uint64_t hash) const;
 
-    // Serialize/deserialize to sidecar file
-    void save(const std::string& path) const;
+    // Serialize/deserialize (SSTable filter block)
+    std::string encode() const;
+    static BloomFilter decode(const std::string& data, bool& ok);
+
+    // Load a sidecar file (tables before format v2)
     static BloomFilter load(const std::string& path, bool& ok);
 
     uint32_t m_bits() const { return m_bits_; }
     uint32_t k_hashes() const { return k_hashes_; }
 
+    static constexpr uint32_t kBlockBits = 512;
+
 private:
+    template <typename T>
+    struct CacheLineAllocator {
+        using value_type = T;
+        CacheLineAllocator() = default;
+        template <typename U>
+        CacheLineAllocator(const CacheLineAllocator<U>&) {}
+        T* allocate(size_t n) {
+            return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(64)));
+        }
+        void deallocate(T* p, size_t) { ::operator delete(p, std::align_val_t(64)); }
+        bool operator==(const CacheLineAllocator&) const { return true; }
+    };
+
     uint32_t m_bits_{0};
     uint32_t k_hashes_{0};
-    std::vector<uint8_t> bits_; // packed bits
+    enum class Format : uint8_t {
+        kWholeArray, // FNV-1a double hashing over all m bits
+        kBlockedFnv, // blocked, FNV-1a
+        kBlocked,    // blocked, key_hash
+    };
+    Format format_{Format::kBlocked};
+    std::vector<uint64_t, CacheLineAllocator<uint64_t>> bits_; // little-endian bit order
 
     static uint64_t fnv1a_64(const uint8_t* data, size_t n);
-    static uint64_t hash64(const std::string& s, uint64_t seed);
+    static uint64_t hash64(std::string_view s, uint64_t seed);
+
+    // index in bits_ of the first word of h's block
+    size_t block_offset_(uint64_t h) const;
+    // h's k bits within its block, as one mask per word
+    void block_mask_(uint64_t h, uint64_t mask[kBlockBits / 64]) const;
 
     void set_bit(uint32_t idx);
     bool get_bit(uint32_t idx) const;
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+class Block;
+
+// Capacity-bounded LRU cache of SSTable data blocks, shared by every table
+// of a DB. Keyed by (file id, block offset). The key space is split across
+// 2^shard_bits shards, each with its own mutex and LRU list, so concurrent
+// readers rarely contend. Evicted blocks stay alive while a reader holds them.
+class BlockCache {
+public:
+    // shard_bits < 0 picks up to 16 shards of at least kMinShardBytes each
+    explicit BlockCache(size_t capacity_bytes, int shard_bits = -1);
+
+    static constexpr size_t kMinShardBytes = 512 << 10;
+
+    std::shared_ptr<const Block> lookup(uint64_t file_id, uint64_t offset);
+    void insert(uint64_t file_id, uint64_t offset, std::shared_ptr<const Block> block,
+                size_t charge);
+
+    uint64_t hits() const { return hits_.load(std::memory_order_relaxed); }
+    uint64_t misses() const { return misses_.load(std::memory_order_relaxed); }
+    size_t usage() const;
+    size_t capacity() const { return capacity_; }
+
+private:
+    struct Key {
+        uint64_t file_id;
+        uint64_t offset;
+        bool operator==(const Key& o) const { return file_id == o.file_id && offset == o.offset; }
+    };
+    struct KeyHash {
+        size_t operator()(const Key& k) const;
+    };
+    struct Entry {
+        Key key;
+        std::shared_ptr<const Block> block;
+        size_t charge;
+    };
+    struct Shard {
+        std::mutex mu;
+        std::list<Entry> lru; // most recently used first
+        std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> map;
+        size_t usage{0};
+        size_t capacity{0};
+    };
+
+    size_t capacity_;
+    int shard_bits_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::atomic<uint64_t> hits_{0};
+    std::atomic<uint64_t> misses_{0};
+
+    Shard& shard_for(const Key& k);
+};
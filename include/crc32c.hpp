@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// CRC-32C (Castagnoli). Uses the SSE4.2 crc32 instruction when the CPU has
+// it, otherwise a slicing-by-8 table.
+namespace crc32c {
+
+// crc of data[0, n) continuing from a previous value(...) result
+uint32_t extend(uint32_t crc, const void* data, size_t n);
+
+inline uint32_t value(const void* data, size_t n) { return extend(0, data, n); }
+
+} // namespace crc32c
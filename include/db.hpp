@@ -2,7 +2,7 @@
 
 #include <string>
 #include <optional>
-#include <map>
+#include <mutex>
 #include <shared_mutex>
 #include <memory>
 #include <vector>
@@ -10,62 +10,298 @@
 #include <thread>
 #include <condition_variable>
 #include <atomic>
+#include <chrono>
+#include <deque>
+#include <exception>
+#include <unordered_set>
+
+#include "options.hpp"
+#include "prefix_extractor.hpp"
 
 class WAL;
 class SSTable;
+class BlockCache;
+class ThreadPool;
+class RateLimiter;
+class Manifest;
+class MemTable;
+class WriteBatch;
+
+// Counters since open.
+struct DBStats {
+    uint64_t block_cache_hits = 0;
+    uint64_t block_cache_misses = 0;
+    size_t block_cache_usage = 0; // bytes
+    std::vector<size_t> files_per_level;
+    size_t filter_bytes = 0; // filters of all live tables, in memory
+    uint64_t prefix_scan_tables_skipped = 0; // by scan_prefix(), filter or range
+    uint64_t wal_groups = 0;       // WAL appends, each for a commit group
+    uint64_t wal_group_writes = 0; // writes in them; / wal_groups = mean group size
+    uint64_t compactions = 0;
+    uint64_t subcompactions = 0; // key ranges those were merged in (max_subcompactions)
+    uint64_t compaction_failures = 0; // aborted on an unreadable input or a write error
+    uint64_t flush_bytes_written = 0;      // write amplification is
+    uint64_t compaction_bytes_written = 0; // (flush + compaction) / flush
+    uint64_t pending_compaction_bytes = 0; // estimate, now
+    uint64_t write_stop_micros = 0;     // writers waiting for flush/compaction
+    uint64_t write_slowdown_micros = 0; // writers paced by the write controller
+    uint64_t rate_limit_bytes_per_sec = 0; // background I/O, as tuned; 0 = unlimited
+    std::string background_error; // first failed flush, compaction, WAL write or sync; empty if none
+};
 
 class HeliosDB {
 public:
-    explicit HeliosDB(const std::string& data_dir);
+    explicit HeliosDB(const std::string& data_dir, const Options& options = Options());
     ~HeliosDB();
 
-    void put(const std::string& key, const std::string& value);
+    void put(const std::string& key, const std::string& value,
+             const WriteOptions& wopts = WriteOptions());
     std::optional<std::string> get(const std::string& key);
-    void del(const std::string& key);
+    // Every live key starting with prefix, in key order, with its value.
+    // Memtables and tables whose prefix filter (Options::prefix_delimiter)
+    // or key range rules the prefix out are not read. Throws if a block
+    // read on the way fails its checksum.
+    std::vector<std::pair<std::string, std::string>> scan_prefix(const std::string& prefix);
+    void del(const std::string& key, const WriteOptions& wopts = WriteOptions());
+
+    // Applies every op in batch or none of them, under one lock acquisition
+    // and one WAL record.
+    void write(const WriteBatch& batch, const WriteOptions& wopts = WriteOptions());
 
     void flush();
     void compact();
     void close();
 
+    // Options::rate_limit_bytes_per_sec, on an open DB
+    void set_rate_limit(uint64_t bytes_per_sec);
+
+    DBStats stats() const;
+
     // Internal replay hooks (no WAL write)
     void apply_put(const std::string& key, const std::string& value);
     void apply_delete(const std::string& key);
 
 private:
+    Options options_;
     std::string data_directory_;
-    std::string manifest_path_;
+    std::unique_ptr<Manifest> manifest_; // changed under mutex_
+    PrefixExtractor prefix_extractor_;
     uint64_t next_sst_id_{1};
 
-    std::map<std::string, std::optional<std::string>> memtable_;
-    size_t memtable_bytes_{0};
+    // Writers hold mutex_ shared and insert into memtable_ concurrently;
+    // exclusive is only taken to swap it out when full.
+    std::shared_ptr<MemTable> memtable_;
     static constexpr size_t kMaxMemtableBytes = 1 << 20;
 
+    // Full memtables waiting to be flushed (oldest first). Reads still
+    // check them. Each one's writes live in WAL segments <= log_number,
+    // which are deleted once it is on disk. Flushes may run in parallel but
+    // are installed oldest first, so L0 stays in age order.
+    struct ImmutableMemTable {
+        std::shared_ptr<MemTable> mem;
+        uint64_t log_number;
+        bool flushing{false};
+        std::shared_ptr<SSTable> table{}; // built, waiting for older ones
+    };
+    std::deque<ImmutableMemTable> imm_;
+    static constexpr size_t kMaxImmutableMemtables = 2;
+
     mutable std::shared_mutex mutex_;
     std::unique_ptr<WAL> wal_;
-    std::vector<std::unique_ptr<SSTable>> sstables_; // newest first
+    uint64_t log_number_{0};         // WAL segment wal_ writes to
+    uint64_t min_log_number_{0};     // oldest WAL segment not yet flushed
+    std::atomic<uint64_t> last_seq_{0};
+
+    // Group commit: writers queue on writers_ (under wal_mu_); the one at the
+    // front is the leader and appends the records of everyone queued behind
+    // it with one WAL write, then wakes them. Each writer inserts its own
+    // entry into memtable_ afterwards, concurrently.
+    struct Writer {
+        const WriteBatch* batch{nullptr}; // or a single op:
+        const std::string* key{nullptr};
+        const std::string* value{nullptr}; // nullptr => delete
+        bool sync{false};
+        uint64_t seq{0};                  // first of count() for a batch
+        bool done{false};
+        std::string error;                // the group's WAL write threw this
+        std::condition_variable cv;
+    };
+    std::mutex wal_mu_;
+    std::deque<Writer*> writers_;
+    std::string group_buf_;          // leader's scratch, reused across groups
+    std::atomic<uint64_t> wal_groups_{0};
+    std::atomic<uint64_t> wal_group_writes_{0};
+    static constexpr size_t kMaxGroupBytes = 1 << 20;
+
+    // Write controller, see Options::level0_slowdown_writes_trigger.
+    // write_stall_ is recomputed under mutex_ whenever current_ changes;
+    // writers check it before taking any lock.
+    enum class WriteStall { kNone, kDelayed, kStopped };
+    std::atomic<WriteStall> write_stall_{WriteStall::kNone};
+    std::mutex stall_mu_;
+    std::condition_variable stall_cv_;
+    double delayed_write_rate_{0}; // bytes/s, under stall_mu_
+    std::chrono::steady_clock::time_point next_write_time_; // under stall_mu_
+    std::atomic<uint64_t> failed_compactions_{0}; // changed under stall_mu_
+    std::atomic<uint64_t> pending_compaction_bytes_{0};
+    std::atomic<uint64_t> write_stop_micros_{0};
+    std::atomic<uint64_t> write_slowdown_micros_{0};
+
+    void delay_write_(size_t bytes); // waits out a stall before a write
+    void update_write_stall_unsafe_();
+    uint64_t pending_compaction_bytes_unsafe_() const;
+
+    // Set by writes that skipped the WAL; close() flushes so they persist.
+    std::atomic<bool> unlogged_writes_{false};
 
-    // Background compaction
-    std::thread bg_;
-    std::condition_variable cv_;
-    std::mutex bg_mu_;
+    // WalMode::kPeriodic background sync
+    std::thread sync_bg_;
+    std::condition_variable sync_cv_;
+    std::mutex sync_mu_;
+    void sync_loop_();
+
+    // Options::background_verify: one full checksum pass over every table
+    std::thread verify_bg_;
+    void verify_tables_();
+    // The tables of every level. A Version never changes once installed:
+    // flushes and compactions apply a VersionEdit to the current one and
+    // swap the result in under mutex_, sharing every SSTable they did not
+    // touch. Readers copy current_ and search it without the lock.
+    struct Version {
+        // levels[0] newest first; levels[1..] sorted by smallest key and
+        // non-overlapping, so a lookup probes at most one table per level.
+        std::vector<std::vector<std::shared_ptr<SSTable>>> levels;
+    };
+    std::shared_ptr<const Version> current_;
+
+    // Everything a read looks at, in one immutable snapshot. It is rebuilt
+    // under mutex_ whenever memtable_, imm_ or current_ changes; get()
+    // loads it without mutex_, so reads never wait behind a flush,
+    // compaction or memtable switch. The load is not lock-free: libstdc++
+    // guards the pointer with a spinlock held for one refcount increment,
+    // on a cache line every reader shares. The tables and memtables a view
+    // holds live on until the last reader holding it drops it.
+    struct ReadView {
+        std::shared_ptr<MemTable> mem;
+        std::vector<std::shared_ptr<MemTable>> imm; // newest first
+        std::shared_ptr<const Version> version;
+    };
+    std::atomic<std::shared_ptr<const ReadView>> read_view_;
+    void install_read_view_unsafe_(); // caller holds mutex_ exclusively
+
+    struct VersionEdit {
+        std::vector<std::pair<int, std::string>> deleted; // level, file name
+        // Added L0 tables are listed newest first and take the place of the
+        // deleted L0 tables, or go in front of L0 if none were deleted.
+        std::vector<std::pair<int, std::shared_ptr<SSTable>>> added;
+        std::optional<uint64_t> log_number; // oldest WAL segment still needed
+    };
+    // Logs the edit to the manifest, then installs it. Caller holds mutex_
+    // exclusively.
+    void apply_edit_unsafe_(const VersionEdit& edit);
+    std::unique_ptr<BlockCache> block_cache_;         // null if disabled
+    std::unique_ptr<RateLimiter> rate_limiter_;
+
+    // Flushes run in the pool's high-priority lane and compactions in the
+    // low one. Counts of running jobs are under mutex_.
+    std::unique_ptr<ThreadPool> pool_;
+    int running_flushes_{0};
+    int running_compactions_{0};
+    std::condition_variable_any imm_cv_; // imm_ lost an entry
     std::atomic<bool> stop_{false};
-    std::atomic<bool> compact_requested_{false};
 
-    static constexpr size_t kCompactThreshold = 8;
-    static constexpr size_t kMergeN = 4;
+    // The first error of a background job. It sticks: nothing more is
+    // flushed or compacted, and every later write and flush() throws it,
+    // until the DB is reopened. Whatever was not flushed is still in the WAL.
+    std::string bg_error_;               // under mutex_
+    std::atomic<bool> bg_failed_{false}; // bg_error_ is set
+    void set_bg_error_unsafe_(const std::string& what); // caller holds mutex_ exclusively
+    void check_bg_error_unsafe_() const; // throws bg_error_; caller holds mutex_
+
+    std::atomic<uint64_t> compactions_{0};
+    std::atomic<uint64_t> subcompactions_{0};
+    std::atomic<uint64_t> flush_bytes_written_{0};
+    std::atomic<uint64_t> compaction_bytes_written_{0};
+    std::atomic<uint64_t> prefix_scan_tables_skipped_{0};
+
+    // One merge: the inputs[0] tables of level plus the inputs[1] tables of
+    // output_level that overlap them, rewritten into output_level. Universal
+    // compactions merge adjacent L0 runs back into L0 (inputs[1] empty).
+    struct Compaction {
+        int level{0};
+        int output_level{1};
+        std::vector<std::string> inputs[2]; // file names, newest first in L0
+        std::string smallest, largest;      // key range of all inputs
+        // the open input tables, in merge order (newest first), taken from
+        // the current Version when the compaction is scheduled
+        std::vector<std::shared_ptr<SSTable>> tables;
+        bool bottommost{false};   // no older table overlaps: drop tombstones
+        bool trivial_move{false}; // one table moves down unchanged
+        double filter_bits_per_key{10}; // for the outputs
+    };
+    // per level, the largest key of the last table compacted out of it, so
+    // successive compactions rotate through the key space
+    std::vector<std::string> compact_pointer_;
 
-    void bg_loop_();
-    void request_compaction_();
+    // Compactions run concurrently as long as they share no input and
+    // their output ranges on the same level do not overlap.
+    std::vector<std::shared_ptr<const Compaction>> running_;
+    std::unordered_set<std::string> being_compacted_;
 
-    void load_manifest_and_sstables_();
-    void write_manifest_atomic_(const std::vector<std::string>& files);
-    std::vector<std::string> read_manifest_files_() const;
+    // Caller holds mutex_ exclusively. Schedules jobs for whatever is
+    // due, up to max_background_flushes / max_background_compactions.
+    void maybe_schedule_flush_unsafe_();
+    void maybe_schedule_compaction_unsafe_();
+    void background_flush_(std::shared_ptr<MemTable> mem, uint64_t id, double filter_bits_per_key);
+    // Options::filter_bits_by_level: bits/key for a new table of entries
+    // keys written to level
+    double filter_bits_per_key_unsafe_(int level, uint64_t entries) const;
+    static constexpr double kMaxFilterBitsPerKey = 30; // ~1e-6 false positives
+    void background_compaction_(std::shared_ptr<const Compaction> c);
+
+    // Caller holds mutex_. Levels over their limit, most urgent first, with
+    // their scores (>= 1 means over).
+    std::vector<std::pair<int, double>> compaction_scores_unsafe_() const;
+    uint64_t max_bytes_for_level_(int level) const;
+    std::optional<Compaction> pick_compaction_unsafe_();
+    std::optional<Compaction> pick_level_compaction_unsafe_(int level);
+    std::optional<Compaction> pick_universal_compaction_unsafe_() const;
+    std::optional<Compaction> pick_deletion_compaction_unsafe_() const;
+    // fills in inputs[1], the key range, bottommost and trivial_move for
+    // inputs[0], which span [smallest, largest] and hold deletions
+    // tombstones; false if it would clash with a running compaction
+    bool setup_compaction_unsafe_(Compaction& c, std::string smallest, std::string largest,
+                                  uint64_t deletions) const;
+    bool deletion_heavy_(const SSTable& t) const; // Options::deletion_compaction_ratio
+
+    void load_manifest_and_sstables_(); // at open; builds current_
 
     std::string make_sstable_filename_(uint64_t id) const;
+    std::string make_wal_filename_(uint64_t number) const;
+
+    void recover_wal_();
+
+    void write_(const WriteOptions& wopts, Writer& w);
+    void commit_group_(Writer& leader, std::unique_lock<std::mutex>& g);
+
+    // Caller holds mutex_ exclusively. Moves a non-empty memtable_ into imm_
+    // and starts a new WAL segment.
+    void switch_memtable_unsafe_(std::unique_lock<std::shared_mutex>& lock);
+    void maybe_flush_unsafe_(std::unique_lock<std::shared_mutex>& lock);
 
-    void maybe_flush_unsafe_();
-    void flush_unsafe_();
-    void compact_once_(); // performs one merge if possible
+    // false if an input was unreadable; throws if an output could not be
+    // written or installed. Either way no output is left behind.
+    bool run_compaction_(const Compaction& c);
 
-    static size_t kv_bytes_(const std::string& k, const std::optional<std::string>& v);
+    // One key range [begin, end) of a compaction (empty = unbounded),
+    // merged and written by one thread.
+    struct Subcompaction {
+        std::string begin;
+        std::string end;
+        std::vector<std::string> outputs; // finished tables, in key order
+        uint64_t bytes_written{0};
+        bool corrupted{false};
+        std::exception_ptr error;
+    };
+    void run_subcompaction_(const Compaction& c, uint64_t per_output, Subcompaction& sub);
 };
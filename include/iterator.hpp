@@ -0,0 +1,21 @@
+#pragma once
+
+#include <optional>
+#include <string>
+
+// Forward iterator over entries in ascending key order.
+// value() == nullopt => tombstone.
+class KVIterator {
+public:
+    virtual ~KVIterator() = default;
+
+    virtual bool valid() const = 0;
+    virtual void next() = 0;
+    virtual void seek(const std::string& target) = 0; // first entry with key >= target
+
+    virtual const std::string& key() const = 0;
+    virtual const std::optional<std::string>& value() const = 0;
+
+    // true if the iterator stopped early on unreadable data
+    virtual bool corrupted() const { return false; }
+};
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// Fast 64-bit key hash (wyhash construction: 8 bytes at a time, 64x64->128
+// multiply to mix). Not stable across versions of this file unless the
+// filter format that stores it changes too.
+namespace key_hash {
+
+uint64_t value(const void* data, size_t n, uint64_t seed = 0);
+
+inline uint64_t value(std::string_view s) { return value(s.data(), s.size()); }
+
+} // namespace key_hash
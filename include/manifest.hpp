@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+// fsyncs dir, which makes a file created, renamed or deleted in it durable.
+// Throws if that fails.
+void sync_dir(const std::string& dir);
+
+// One change to the set of live tables. Added L0 files are listed newest
+// first and take the place of the deleted L0 files, or go in front of L0
+// if none were deleted.
+struct ManifestEdit {
+    std::vector<std::pair<int, std::string>> deleted; // level, file name
+    std::vector<std::pair<int, std::string>> added;
+    std::optional<uint64_t> next_file_id;
+    std::optional<uint64_t> log_number; // WAL segments below it are flushed
+};
+
+// Append-only log of ManifestEdits in MANIFEST-NNNNNN, named by the CURRENT
+// file. Each record is [len u32][crc32c u32][payload] and is fsynced before
+// log_and_apply() returns, so an install costs one small append however
+// many tables exist. A log starts with a single edit holding the whole
+// state; once it grows past max_bytes the state is written to a new log,
+// which CURRENT is switched to only after it is durable. So is it after
+// an append fails, rather than writing past a possibly torn record.
+//
+// Data dirs from before the log keep their tables in manifest.txt, one
+// "<file> <level>" line each (L0 oldest first); it is migrated on open.
+class Manifest {
+public:
+    // Replays the log CURRENT names, stopping at the first torn or corrupt
+    // record, then starts a new log from the result. Throws if a file's
+    // level is >= num_levels.
+    Manifest(const std::string& dir, int num_levels, uint64_t max_bytes);
+    ~Manifest();
+
+    Manifest(const Manifest&) = delete;
+    Manifest& operator=(const Manifest&) = delete;
+
+    void log_and_apply(const ManifestEdit& edit);
+
+    // levels()[0] newest first; deeper levels in no particular order
+    const std::vector<std::vector<std::string>>& levels() const { return levels_; }
+    bool contains(int level, const std::string& file) const;
+    uint64_t next_file_id() const { return next_file_id_; }
+    uint64_t log_number() const { return log_number_; }
+
+private:
+    std::string dir_;
+    int num_levels_;
+    uint64_t max_bytes_;
+
+    std::vector<std::vector<std::string>> levels_;
+    uint64_t next_file_id_{1};
+    uint64_t log_number_{0};
+
+    uint64_t manifest_number_{0};
+    int fd_{-1};
+    uint64_t size_{0};
+    bool failed_{false}; // an append failed; the log may end in a torn record
+
+    void apply_(const ManifestEdit& edit);
+    bool replay_(const std::string& path); // false if it cannot be read at all
+    void read_legacy_(const std::string& path);
+    void write_record_(const ManifestEdit& edit);
+    void roll_(); // new log holding the current state, then CURRENT -> it
+
+    std::string manifest_name_(uint64_t number) const;
+    static void encode_(std::string& dst, const ManifestEdit& edit);
+    static bool decode_(const char* p, size_t n, ManifestEdit& edit);
+};
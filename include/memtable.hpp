@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "iterator.hpp"
+#include "prefix_extractor.hpp"
+
+// Concurrent SkipList MemTable.
+//
+// Inserts are lock-free (one CAS per level) and may run from many threads at
+// once; readers never lock. Nodes are never unlinked, so every write is a new
+// node ordered by (key asc, seq desc) and the newest version of a key is the
+// first node at or after it.
+//
+// With a prefix extractor, a lock-free Bloom filter of the keys' prefixes
+// lets prefix scans skip a memtable that has none of theirs.
+class MemTable {
+public:
+    explicit MemTable(PrefixExtractor prefix_extractor = PrefixExtractor());
+    ~MemTable();
+
+    MemTable(const MemTable&) = delete;
+    MemTable& operator=(const MemTable&) = delete;
+
+    // value == nullopt => tombstone. seq must be unique per MemTable.
+    void add(uint64_t seq, const std::string& key, std::optional<std::string> value);
+
+    // get() returns:
+    // - nullopt => not found in this memtable
+    // - optional<string> == nullopt => tombstone
+    // - optional<string> == value => found value
+    std::optional<std::optional<std::string>> get(const std::string& key) const;
+
+    size_t approximate_bytes() const { return bytes_.load(std::memory_order_relaxed); }
+    size_t num_entries() const { return entries_.load(std::memory_order_relaxed); } // all versions
+    bool empty() const;
+
+    // false if no key added so far has this prefix (as extracted);
+    // hash is key_hash::value(prefix). Always true without an extractor.
+    bool may_contain_prefix(uint64_t hash) const;
+
+private:
+    struct Node;
+
+public:
+    // Visits the newest version of each key in ascending key order.
+    // Safe to use concurrently with add(); entries inserted after the
+    // iterator passed their position are not seen.
+    class Iterator : public KVIterator {
+    public:
+        explicit Iterator(const MemTable& mem);
+
+        bool valid() const override { return node_ != nullptr; }
+        void next() override;
+        void seek(const std::string& target) override;
+
+        const std::string& key() const override;
+        const std::optional<std::string>& value() const override;
+
+    private:
+        const MemTable& mem_;
+        const Node* node_{nullptr};
+    };
+
+private:
+    static constexpr int kMaxHeight = 12;
+    static constexpr size_t kPrefixBloomBits = 1 << 16; // ~6k prefixes at 1%
+    static constexpr int kPrefixBloomProbes = 6;
+
+    Node* head_;
+    std::atomic<int> max_height_{1};
+    std::atomic<size_t> bytes_{0};
+    std::atomic<size_t> entries_{0};
+
+    PrefixExtractor prefix_extractor_;
+    std::unique_ptr<std::atomic<uint64_t>[]> prefix_bloom_; // null if disabled
+
+    static Node* new_node(int height, uint64_t seq, const std::string& key,
+                          std::optional<std::string> value);
+    static void delete_node(Node* n);
+    static int random_height();
+
+    // true if a orders before (key, seq)
+    static bool node_less(const Node* a, const std::string& key, uint64_t seq);
+
+    // first node >= (key, seq), walking down from the top level
+    const Node* find_greater_or_equal(const std::string& key, uint64_t seq) const;
+
+    void find_splice_for_level(const Node* x, Node* before, int level,
+                               Node** out_prev, Node** out_next) const;
+};
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "iterator.hpp"
+
+// K-way merge of sorted iterators through a min-heap on (key, child index).
+// children[0] is the newest source: when several children hold the same key
+// only the newest entry is returned and the older ones are skipped. Memory is
+// one entry per child, whatever the size of the inputs.
+class MergingIterator : public KVIterator {
+public:
+    explicit MergingIterator(std::vector<std::unique_ptr<KVIterator>> children);
+
+    bool valid() const override { return !heap_.empty(); }
+    void next() override;
+    void seek(const std::string& target) override;
+
+    const std::string& key() const override { return children_[heap_.front()]->key(); }
+    const std::optional<std::string>& value() const override {
+        return children_[heap_.front()]->value();
+    }
+
+    bool corrupted() const override; // any child stopped early
+
+private:
+    std::vector<std::unique_ptr<KVIterator>> children_;
+    std::vector<size_t> heap_; // indexes of valid children
+    std::string cur_;          // key being skipped in next()
+
+    // heap order: true if a should sit below b
+    bool after(size_t a, size_t b) const;
+    void rebuild_heap();
+};
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// How hard the WAL tries to survive a crash.
+enum class WalMode {
+    kSync,      // fdatasync every commit group; survives power loss
+    kPeriodic,  // background fdatasync every wal_sync_interval_ms
+    kBuffered,  // write() only; survives a process crash, not power loss
+    kDisabled,  // no WAL; writes since the last flush are lost on crash
+};
+
+// Per-table filter that lets lookups skip tables without the key.
+enum class FilterType {
+    kBloom,      // 10 bits/key, ~1% false positives
+    kBinaryFuse, // static, ~9-10 bits/key at 0.4%: about 25% less memory
+                 // than a Bloom filter at that rate
+};
+
+enum class CompactionStyle {
+    kLeveled,   // low read and space amplification
+    kUniversal, // size-tiered: low write amplification, more runs to read
+};
+
+// Per-DB settings, fixed at open.
+struct Options {
+    WalMode wal_mode = WalMode::kBuffered;
+    uint32_t wal_sync_interval_ms = 100; // kPeriodic only
+
+    // SSTable data blocks are checksummed when read. If set, a background
+    // thread also verifies every table once after open and drops any that
+    // fail, as recovery does for tables that fail to open.
+    bool background_verify = false;
+
+    // Bytes of uncompressed data blocks cached in memory, shared by every
+    // table of the DB. 0 disables the cache.
+    size_t block_cache_bytes = 8 << 20;
+
+    // Filter for newly written tables; tables with the other kind stay
+    // readable, so this can change between opens.
+    FilterType filter_type = FilterType::kBloom;
+
+    // Bloom filter bits per key, averaged over the DB. A lookup probes the
+    // filter of every sorted run (each L0 table, each deeper level), and
+    // the sum of their false positive rates is the block reads it wastes.
+    // With filter_bits_by_level that sum is minimized for the same memory
+    // (Monkey): each run's rate is kept proportional to its size, so small
+    // recent runs get more bits per key and the largest level fewer, down
+    // to none. A filter_memory_budget (bytes, 0 = none) replaces
+    // filter_bits_per_key with the budget spread over the keys in the DB.
+    // Binary fuse filters have a fixed size and ignore these.
+    double filter_bits_per_key = 10;
+    bool filter_bits_by_level = true;
+    uint64_t filter_memory_budget = 0;
+
+    // Prefix extractor: with prefix_delimiter_count > 0, a key's prefix is
+    // everything up to and including that many prefix_delimiters, e.g.
+    // "tenant:" of "tenant:entity:field" with ':' and 1. Tables and
+    // memtables then also filter their keys' prefixes, and scan_prefix()
+    // skips those without the scanned one. Tables written under another
+    // extractor are still read, just not skipped.
+    char prefix_delimiter = ':';
+    unsigned prefix_delimiter_count = 0;
+
+    // The manifest logs every change to the set of tables; past this size
+    // it is rewritten as a snapshot of the current set.
+    uint64_t max_manifest_file_size = 4 << 20;
+
+    // Leveled compaction. L0 holds flushed tables, which may overlap. Each
+    // level from L1 to num_levels-1 is one sorted run of non-overlapping
+    // tables, max_bytes_for_level_multiplier times the size of the one above.
+    int num_levels = 7;
+    int level0_file_num_compaction_trigger = 4;
+    uint64_t max_bytes_for_level_base = 10 << 20; // L1
+    int max_bytes_for_level_multiplier = 10;
+    uint64_t target_file_size = 2 << 20; // compaction output is split at this size
+
+    // Write stalls. Once L0 reaches level0_slowdown_writes_trigger tables, or
+    // the bytes compaction is estimated to still have to rewrite reach
+    // soft_pending_compaction_bytes_limit, writes are paced at
+    // delayed_write_rate bytes/s, falling further as the backlog nears the
+    // stop limits. At level0_stop_writes_trigger or
+    // hard_pending_compaction_bytes_limit writes wait until compaction
+    // catches up. 0 disables a limit.
+    int level0_slowdown_writes_trigger = 20;
+    int level0_stop_writes_trigger = 36;
+    uint64_t soft_pending_compaction_bytes_limit = 1ull << 30;
+    uint64_t hard_pending_compaction_bytes_limit = 4ull << 30;
+    uint64_t delayed_write_rate = 16 << 20;
+
+    // Background threads: flushes and compactions have separate pools, so
+    // a flush never queues behind a compaction.
+    int max_background_flushes = 1;
+    int max_background_compactions = 1;
+
+    // Bytes/s of flush and compaction I/O, shared by all of it; 0 means
+    // unlimited. Can be changed on an open DB with set_rate_limit(). Flushes
+    // are charged but never delayed. With rate_limit_auto_tune the limit is
+    // a ceiling, lowered while foreground read latency is up.
+    uint64_t rate_limit_bytes_per_sec = 0;
+    bool rate_limit_auto_tune = false;
+
+    // A leveled compaction of at least two target_file_size of input is cut
+    // into up to this many key ranges, each merged by its own thread.
+    unsigned max_subcompactions = 1;
+
+    // Universal compaction keeps every table in L0 as one sorted run and
+    // merges runs of similar size once there are
+    // level0_file_num_compaction_trigger of them. A run joins a merge if it
+    // is at most universal_size_ratio percent larger than the runs already
+    // picked. When the runs newer than the oldest one add up to
+    // universal_max_size_amplification_percent of it, everything is merged.
+    CompactionStyle compaction_style = CompactionStyle::kLeveled;
+    unsigned universal_size_ratio = 1;
+    unsigned universal_min_merge_width = 2;
+    unsigned universal_max_size_amplification_percent = 200;
+
+    // Compaction drops tombstones once no older table can hold the key.
+    // Tables that are at least this fraction tombstones are compacted even
+    // when no level is over its limit, so deleted space comes back sooner.
+    // 0 disables.
+    double deletion_compaction_ratio = 0.5;
+};
+
+// Per-write overrides of Options::wal_mode.
+struct WriteOptions {
+    bool sync = false;        // fdatasync before returning, whatever the mode
+    bool disable_wal = false; // skip the WAL (e.g. bulk loads)
+};
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+
+// A key's prefix: everything up to and including its count'th delimiter,
+// e.g. "tenant:" of "tenant:entity:field" for ':' and 1. Keys with fewer
+// delimiters have no prefix. count 0 disables it.
+class PrefixExtractor {
+public:
+    PrefixExtractor() = default;
+    PrefixExtractor(char delimiter, unsigned count) : delimiter_(delimiter), count_(count) {}
+
+    bool enabled() const { return count_ > 0; }
+
+    std::optional<std::string_view> prefix(std::string_view key) const {
+        if (count_ == 0) return std::nullopt;
+        size_t pos = 0;
+        for (unsigned i = 0; i < count_; ++i) {
+            pos = key.find(delimiter_, pos);
+            if (pos == std::string_view::npos) return std::nullopt;
+            ++pos;
+        }
+        return key.substr(0, pos);
+    }
+
+    // Stored with prefix filters: a table's filter is only used by an
+    // extractor of the same name.
+    std::string name() const {
+        return "delim:" + std::to_string(static_cast<unsigned char>(delimiter_)) + ":" + std::to_string(count_);
+    }
+
+private:
+    char delimiter_{':'};
+    unsigned count_{0};
+};
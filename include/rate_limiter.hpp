@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+// Token bucket shared by all background I/O of a DB. Tokens (bytes) refill
+// continuously at bytes_per_second, up to kRefillPeriod's worth. Low
+// priority requests (compaction) wait for tokens; high priority ones
+// (flush) take them at once, going into debt if need be, so they are
+// never delayed but still slow compactions down.
+//
+// With auto_tune, bytes_per_second is a ceiling. Foreground block reads
+// report their latency, and every kTunePeriod the rate drops while it is
+// well above its usual level and climbs back while it is not.
+class RateLimiter {
+public:
+    enum class Priority { kHigh, kLow };
+
+    // 0 = unlimited
+    explicit RateLimiter(uint64_t bytes_per_second, bool auto_tune = false);
+
+    RateLimiter(const RateLimiter&) = delete;
+    RateLimiter& operator=(const RateLimiter&) = delete;
+
+    void request(size_t bytes, Priority pri);
+
+    // Takes effect for requests already waiting too.
+    void set_bytes_per_second(uint64_t bytes_per_second);
+    uint64_t bytes_per_second() const { return rate_.load(std::memory_order_relaxed); } // as tuned
+
+    void record_read_latency(uint64_t micros);
+
+    static constexpr std::chrono::milliseconds kRefillPeriod{100};
+    static constexpr std::chrono::milliseconds kTunePeriod{100};
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    const bool auto_tune_;
+    std::atomic<uint64_t> rate_;     // current
+    std::atomic<uint64_t> max_rate_; // as set
+
+    std::mutex mu_;
+    std::condition_variable cv_;
+    double available_{0};            // may be negative after high priority
+    Clock::time_point last_refill_;
+
+    // auto-tune: read latency of the current period, and a baseline of
+    // periods that were not slowed down
+    std::atomic<uint64_t> latency_sum_{0};
+    std::atomic<uint64_t> latency_count_{0};
+    double baseline_micros_{0};
+    Clock::time_point last_tune_;
+
+    void refill_(Clock::time_point now); // caller holds mu_
+    void tune_(Clock::time_point now);   // caller holds mu_
+};
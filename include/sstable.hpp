@@ -5,19 +5,165 @@
 #include <vector>
 #include <cstdint>
 #include <memory>
+#include <atomic>
+#include <fstream>
 
+#include "block.hpp"
 #include "bloom.hpp"
+#include "fuse_filter.hpp"
+#include "iterator.hpp"
+#include "options.hpp"
+#include "prefix_extractor.hpp"
+#include "rate_limiter.hpp"
 
+class BlockCache;
+
+// On-disk layout (format v3):
+//   [data block][crc]*   ~kBlockSize each, see block.hpp; CRC32C trailer
+//   [filter block]       serialized BloomFilter or BinaryFuseFilter over all
+//                        keys; its leading magic says which
+//   [properties block]   entry/deletion counts, smallest and largest key,
+//                        then, with a prefix extractor, its name and a
+//                        BloomFilter over the distinct key prefixes
+//   [index block]        one entry per data block: last key + block handle
+//   [footer]             meta block handles and checksum, version, magic
+// Opening a table reads the footer and then the meta blocks with one pread,
+// so it costs O(index + filter), not O(file). A point lookup is a binary
+// search of the in-memory index followed by a single pread of one block.
+// Each block's checksum is verified when it is read; a mismatch marks the
+// whole table corrupted and it stops answering lookups. Verified data blocks
+// are kept in the DB's BlockCache under (file_id, offset) when one is given.
+// With a RateLimiter, block reads of scans (compaction) are charged to it
+// and point lookups report their read latency to it.
+//
+// v1 tables (no filter/properties blocks, bloom in a .bloom sidecar) and v2
+// tables (no block trailers; one checksum over the body) are still readable.
 class SSTable {
 public:
     // get() returns:
     // - nullopt => not found in this table
     // - optional<string> == nullopt => tombstone
     // - optional<string> == value => found value
-    explicit SSTable(const std::string& path);
+    // file_id must be unique among the tables sharing cache.
+    explicit SSTable(const std::string& path, BlockCache* cache = nullptr,
+                     uint64_t file_id = 0, RateLimiter* rate_limiter = nullptr);
     ~SSTable();
 
     std::optional<std::optional<std::string>> get(const std::string& key) const;
+    // hash is key_hash::value(key), computed once for every table probed
+    std::optional<std::optional<std::string>> get(const std::string& key, uint64_t hash) const;
+
+    bool valid() const { return valid_; }
+    bool corrupted() const { return corrupted_.load(std::memory_order_relaxed); }
+    uint32_t format_version() const { return version_; }
+    const std::string& path() const { return path_; }
+    uint64_t file_size() const { return file_size_; }
+    uint64_t num_entries() const { return num_entries_; }
+    uint64_t num_deletions() const { return num_deletions_; }
+    size_t filter_bytes() const;
+
+    // false if the table has no key with this prefix, as extracted by the
+    // named PrefixExtractor; hash is key_hash::value(prefix). True if the
+    // table has no prefix filter from that extractor.
+    bool may_contain_prefix(const std::string& extractor_name, std::string_view prefix,
+                            uint64_t hash) const;
+    const std::string& smallest() const { return smallest_; }
+    const std::string& largest() const { return largest_; }
+
+    // The file (and any .bloom sidecar) is deleted once this object is
+    // destroyed, i.e. when the last reader holding the table lets go.
+    void mark_obsolete() { obsolete_.store(true, std::memory_order_relaxed); }
+
+    // Last key of every data block, ascending. Each stands for about
+    // kBlockSize bytes of data, so they are sample points for splitting
+    // the table's key range into parts of similar size.
+    std::vector<std::string> block_boundaries() const;
+
+    // Forward scan over every entry in key order, one block read at a time.
+    // By default it is background work (compaction): blocks it reads are
+    // charged to the rate limiter and not cached. A foreground scan passes
+    // fill_cache, and reads like get() does.
+    class Iterator : public KVIterator {
+    public:
+        explicit Iterator(const SSTable& table, bool fill_cache = false);
+
+        bool valid() const override { return valid_; }
+        bool corrupted() const override { return corrupted_; } // stopped on a bad block
+        void next() override;
+        void seek(const std::string& target) override;
+
+        const std::string& key() const override { return key_; }
+        const std::optional<std::string>& value() const override { return value_; }
+
+    private:
+        const SSTable& table_;
+        bool fill_cache_;
+        size_t block_idx_{0};
+        uint32_t entry_idx_{0};
+        std::shared_ptr<const Block> block_; // block_idx_'s, once read
+        std::string key_;
+        std::optional<std::string> value_;
+        bool valid_{false};
+        bool corrupted_{false};
+
+        void load_entry(); // from (block_idx_, entry_idx_), moving to later blocks as needed
+    };
+
+    // Writes a table one entry at a time: data blocks go to a tmp file as
+    // they fill, finish() appends the meta blocks and footer and renames the
+    // file into place. Memory is one block plus the index and filter.
+    class Builder {
+    public:
+        // expected_entries sizes a bloom filter; an overestimate only
+        // costs filter bits, an underestimate raises its false positive rate.
+        // A binary fuse filter is built at finish() from the key hashes.
+        // bits_per_key <= 0 writes no bloom filter. An enabled
+        // prefix_extractor adds a prefix filter to the properties block.
+        // Writes are charged to rate_limiter, if given, at priority.
+        Builder(const std::string& final_path, uint64_t expected_entries,
+                FilterType filter_type = FilterType::kBloom, double bits_per_key = 10,
+                RateLimiter* rate_limiter = nullptr,
+                RateLimiter::Priority priority = RateLimiter::Priority::kLow,
+                PrefixExtractor prefix_extractor = PrefixExtractor());
+        ~Builder(); // removes the tmp file if finish() was not reached
+
+        Builder(const Builder&) = delete;
+        Builder& operator=(const Builder&) = delete;
+
+        // keys must be added in strictly ascending order
+        void add(const std::string& key, const std::optional<std::string>& value);
+        void finish();
+
+        uint64_t num_entries() const { return num_entries_; }
+        uint64_t file_size() const { return offset_; } // bytes written so far
+
+    private:
+        std::string final_path_;
+        std::string tmp_path_;
+        std::ofstream out_;
+        RateLimiter* rate_limiter_{nullptr};
+        RateLimiter::Priority priority_;
+        uint64_t offset_{0};
+        bool finished_{false};
+
+        FilterType filter_type_;
+        BloomFilter bloom_;
+        std::vector<uint64_t> key_hashes_; // kBinaryFuse
+        PrefixExtractor prefix_extractor_;
+        std::vector<uint64_t> prefix_hashes_; // one per distinct prefix
+        std::string last_prefix_;
+        BlockBuilder block_;
+        std::string index_;
+        uint32_t num_blocks_{0};
+
+        uint64_t num_entries_{0};
+        uint64_t num_deletions_{0};
+        std::string smallest_;
+        std::string last_key_;
+
+        void emit(const void* p, size_t n);
+        void flush_block();
+    };
 
     // entries must be sorted by key ascending
     static void write_atomic(
@@ -25,37 +171,61 @@ public:
         const std::vector<std::pair<std::string, std::optional<std::string>>>& entries
     );
 
+    // Full check of every checksum in the file; reads the whole file.
     static bool is_valid(const std::string& path);
 
+    // Tables written before the block format are a flat run of records.
+    // Rewrites such a table in place in the current format; returns false
+    // (and leaves the file alone) if path is not a valid legacy table.
+    static bool upgrade_legacy(const std::string& path);
+
+    static constexpr size_t kBlockSize = 4096;
+
 private:
     struct IndexEntry {
-        std::string key;
+        std::string key; // last key in the block
         uint64_t offset;
+        uint32_t size;
     };
 
     std::string path_;
+    BlockCache* cache_{nullptr};
+    uint64_t file_id_{0};
+    RateLimiter* rate_limiter_{nullptr};
     int fd_{-1};
-    uint64_t end_{0}; // end of records region (exclude footer)
+    uint64_t file_size_{0};
+    uint32_t version_{0};
     bool valid_{false};
+    mutable std::atomic<bool> corrupted_{false};
+    std::atomic<bool> obsolete_{false};
 
     std::vector<IndexEntry> index_;
-    static constexpr uint32_t kIndexStride = 16;
 
+    FilterType filter_type_{FilterType::kBloom};
     BloomFilter bloom_;
-    bool bloom_ok_{false};
+    BinaryFuseFilter fuse_;
+    bool filter_ok_{false};
+    std::string prefix_extractor_name_; // empty: no prefix filter
+    BloomFilter prefix_bloom_;
 
-    static constexpr uint32_t TOMBSTONE_VSIZE = 0xFFFFFFFFu;
+    // properties
+    uint64_t num_entries_{0};
+    uint64_t num_deletions_{0};
+    std::string smallest_;
+    std::string largest_;
 
-    static uint32_t fnv1a_32(const uint8_t* data, size_t n);
+    static uint32_t fnv1a_32(const uint8_t* data, size_t n, uint32_t h = 2166136261u);
 
     bool pread_all(void* buf, size_t n, uint64_t off) const;
-
-    bool read_record_at(
-        uint64_t offset,
-        std::string& out_key,
-        std::optional<std::string>& out_value,
-        uint64_t& out_next_offset
-    ) const;
+    // fill_cache=false still uses cached blocks but does not add new ones,
+    // so a full scan (compaction) does not evict the working set.
+    std::shared_ptr<const Block> read_block(const IndexEntry& e, bool fill_cache = true) const;
+    std::shared_ptr<const Block> load_block(const IndexEntry& e) const; // always from disk
+    bool verify_blocks() const;
+    bool open_v1(uint64_t file_size);
+    bool open_v2(uint64_t file_size);
+    bool parse_index(const char* p, uint64_t size, uint64_t data_end);
+    bool parse_properties(const char* p, uint64_t size);
 
     static std::string bloom_path_for(const std::string& sstable_path);
 };
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Background job pool with one lane per priority. Each lane has its own
+// threads, so a high-priority job (a flush) never waits behind a
+// low-priority one (a compaction), however long that runs.
+class ThreadPool {
+public:
+    enum class Priority { kHigh, kLow };
+
+    ThreadPool(int high_threads, int low_threads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    void schedule(std::function<void()> job, Priority pri);
+
+    // Waits for running jobs and joins every thread; queued jobs are
+    // dropped. schedule() is a no-op afterwards.
+    void shutdown();
+
+private:
+    struct Lane {
+        std::deque<std::function<void()>> queue;
+        std::vector<std::thread> threads;
+        std::condition_variable cv;
+    };
+
+    std::mutex mu_;
+    Lane lanes_[2];
+    bool stop_{false};
+
+    void run_(Lane& lane);
+};
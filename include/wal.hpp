@@ -1,28 +1,42 @@
 #pragma once
 
+#include <atomic>
 #include <string>
-#include <fstream>
 #include <cstdint>
 
 class HeliosDB;
+class WriteBatch;
 
 class WAL {
 public:
     explicit WAL(const std::string& path);
     ~WAL();
 
-    void append_put(const std::string& key, const std::string& value);
-    void append_delete(const std::string& key);
+    // Record encoders. Callers batch any number of records into one buffer
+    // and hand it to add_records().
+    static void encode_put(std::string& dst, const std::string& key, const std::string& value);
+    static void encode_delete(std::string& dst, const std::string& key);
+    static void encode_batch(std::string& dst, const WriteBatch& batch);
 
-    void replay(HeliosDB& db);
-    void reset();
+    // Appends buf with a single write(); also fdatasync()s if sync. Both
+    // throw on failure, and once either has failed every later call throws
+    // too: the log can no longer be trusted past that point.
+    void add_records(const std::string& buf, bool sync);
+    void sync();
+
+    // Applies every intact record of the log at path, stopping at the
+    // first torn or corrupt one.
+    static void replay(const std::string& path, HeliosDB& db);
 
 private:
     std::string path_;
-    std::ofstream out_;
+    int fd_{-1};
+    std::atomic<bool> failed_{false}; // sync() may run beside add_records()
 
-    static uint32_t fnv1a_32(const uint8_t* data, size_t n);
+    static uint32_t fnv1a_32(const uint8_t* data, size_t n, uint32_t h = 2166136261u);
 
     // record encoding helpers
-    void append_record(uint8_t type, const std::string& key, const std::string* value);
+    static uint32_t record_checksum(uint8_t type, const std::string& key, const std::string* value);
+    static void encode_record(std::string& dst, uint8_t type, const std::string& key,
+                              const std::string* value);
 };
\ No newline at end of file
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+// An ordered group of puts and deletes applied atomically by
+// HeliosDB::write(). It is logged as one checksummed WAL record, so
+// recovery applies either all of it or none of it.
+class WriteBatch {
+public:
+    WriteBatch() = default;
+
+    void put(const std::string& key, const std::string& value);
+    void del(const std::string& key);
+    void clear();
+
+    size_t count() const { return count_; }
+    bool empty() const { return count_ == 0; }
+    size_t byte_size() const { return rep_.size(); }
+
+    // Calls fn(key, value) for each op in order; value == nullptr => delete.
+    // Returns false (after visiting the intact prefix) if rep_ is malformed.
+    bool iterate(const std::function<void(const std::string&, const std::string*)>& fn) const;
+
+private:
+    friend class WAL;
+
+    // [type u8][ksize u32][vsize u32][key][value] per op; type 1=put, 2=del
+    std::string rep_;
+    size_t count_{0};
+
+    void append_op(uint8_t type, const std::string& key, const std::string* value);
+};
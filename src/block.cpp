@@ -0,0 +1,90 @@
+#include "block.hpp"
+
+#include <cstring>
+
+static uint32_t load_u32(const char* p) {
+    uint32_t x;
+    std::memcpy(&x, p, 4);
+    return x;
+}
+
+void BlockBuilder::add(const std::string& key, const std::optional<std::string>& value) {
+    offsets_.push_back(static_cast<uint32_t>(rep_.size()));
+
+    const uint32_t ksize = static_cast<uint32_t>(key.size());
+    const uint32_t vsize = value ? static_cast<uint32_t>(value->size()) : kTombstoneVSize;
+    rep_.append(reinterpret_cast<const char*>(&ksize), 4);
+    rep_.append(reinterpret_cast<const char*>(&vsize), 4);
+    rep_.append(key);
+    if (value) rep_.append(*value);
+}
+
+std::string BlockBuilder::finish() {
+    for (uint32_t off : offsets_) rep_.append(reinterpret_cast<const char*>(&off), 4);
+    const uint32_t n = static_cast<uint32_t>(offsets_.size());
+    rep_.append(reinterpret_cast<const char*>(&n), 4);
+
+    std::string out;
+    out.swap(rep_);
+    offsets_.clear();
+    return out;
+}
+
+Block::Block(std::string contents)
+    : data_(std::move(contents))
+{
+    if (data_.size() < 4) return;
+    n_ = load_u32(data_.data() + data_.size() - 4);
+    const uint64_t trailer = 4ULL * n_ + 4;
+    if (trailer > data_.size()) { n_ = 0; return; }
+    offsets_at_ = static_cast<uint32_t>(data_.size() - trailer);
+    ok_ = true;
+}
+
+bool Block::entry(uint32_t i, std::string_view& key,
+                  std::optional<std::string_view>& value) const {
+    if (i >= n_) return false;
+    const uint32_t off = load_u32(data_.data() + offsets_at_ + 4ULL * i);
+    if (static_cast<uint64_t>(off) + 8 > offsets_at_) return false;
+
+    const uint32_t ksize = load_u32(data_.data() + off);
+    const uint32_t vsize = load_u32(data_.data() + off + 4);
+    const uint64_t kend = static_cast<uint64_t>(off) + 8 + ksize;
+    if (kend > offsets_at_) return false;
+    key = std::string_view(data_.data() + off + 8, ksize);
+
+    if (vsize == kTombstoneVSize) {
+        value = std::nullopt;
+        return true;
+    }
+    if (kend + vsize > offsets_at_) return false;
+    value = std::string_view(data_.data() + kend, vsize);
+    return true;
+}
+
+std::string_view Block::key_at(uint32_t i) const {
+    std::string_view k;
+    std::optional<std::string_view> v;
+    if (!entry(i, k, v)) return std::string_view();
+    return k;
+}
+
+uint32_t Block::lower_bound(std::string_view target) const {
+    uint32_t lo = 0, hi = n_;
+    while (lo < hi) {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        if (key_at(mid) < target) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+std::optional<std::optional<std::string>> Block::get(const std::string& key) const {
+    const uint32_t i = lower_bound(key);
+
+    std::string_view k;
+    std::optional<std::string_view> v;
+    if (!entry(i, k, v) || k != key) return std::nullopt;
+    if (!v) return std::optional<std::string>();
+    return std::optional<std::string>(std::string(*v));
+}
@@ -1,16 +1,23 @@
 #include "bloom.hpp"
+#include "key_hash.hpp"
 #include <fstream>
-#include <stdexcept>
+#include <iterator>
 #include <cstring>
 
+static constexpr uint32_t kWholeArrayMagic = 0xB100B100u;
+static constexpr uint32_t kBlockedFnvMagic = 0xB100B101u;
+static constexpr uint32_t kBlockedMagic = 0xB100B102u;
+static constexpr uint32_t kBlockWords = BloomFilter::kBlockBits / 64;
+
 BloomFilter::BloomFilter(uint32_t m_bits, uint32_t k_hashes)
     : m_bits_(m_bits), k_hashes_(k_hashes) {
     if (m_bits_ == 0 || k_hashes_ == 0) {
         m_bits_ = 0; k_hashes_ = 0; bits_.clear();
         return;
     }
-    const uint32_t nbytes = (m_bits_ + 7) / 8;
-    bits_.assign(nbytes, 0);
+    const uint32_t blocks = (m_bits_ + kBlockBits - 1) / kBlockBits;
+    m_bits_ = blocks * kBlockBits;
+    bits_.assign(static_cast<size_t>(blocks) * kBlockWords, 0);
 }
 
 uint64_t BloomFilter::fnv1a_64(const uint8_t* data, size_t n) {
@@ -22,7 +29,7 @@ uint64_t BloomFilter::fnv1a_64(const uint8_t* data, size_t n) {
     return h;
 }
 
-uint64_t BloomFilter::hash64(const std::string& s, uint64_t seed) {
+uint64_t BloomFilter::hash64(std::string_view s, uint64_t seed) {
     uint64_t h = seed;
     h ^= fnv1a_64(reinterpret_cast<const uint8_t*>(s.data()), s.size());
     // mix
@@ -34,19 +41,48 @@ uint64_t BloomFilter::hash64(const std::string& s, uint64_t seed) {
     return h;
 }
 
+size_t BloomFilter::block_offset_(uint64_t h) const {
+    const uint64_t blocks = m_bits_ / kBlockBits;
+    return static_cast<size_t>((h >> 32) * blocks >> 32) * kBlockWords;
+}
+
+void BloomFilter::block_mask_(uint64_t h, uint64_t mask[kBlockWords]) const {
+    for (uint32_t w = 0; w < kBlockWords; ++w) mask[w] = 0;
+    // each step remixes the low half and takes its top 9 bits
+    uint32_t a = static_cast<uint32_t>(h);
+    for (uint32_t i = 0; i < k_hashes_; ++i) {
+        const uint32_t bit = a >> (32 - 9);
+        mask[bit / 64] |= 1ULL << (bit % 64);
+        a *= 0x9e3779b9u;
+    }
+}
+
 void BloomFilter::set_bit(uint32_t idx) {
     idx %= m_bits_;
-    bits_[idx / 8] |= static_cast<uint8_t>(1u << (idx % 8));
+    bits_[idx / 64] |= 1ULL << (idx % 64);
 }
 
 bool BloomFilter::get_bit(uint32_t idx) const {
     idx %= m_bits_;
-    return (bits_[idx / 8] & static_cast<uint8_t>(1u << (idx % 8))) != 0;
+    return (bits_[idx / 64] & (1ULL << (idx % 64))) != 0;
+}
+
+void BloomFilter::add_hash(uint64_t hash) {
+    if (m_bits_ == 0 || k_hashes_ == 0 || format_ == Format::kWholeArray) return;
+    uint64_t mask[kBlockWords];
+    block_mask_(hash, mask);
+    uint64_t* block = bits_.data() + block_offset_(hash);
+    for (uint32_t w = 0; w < kBlockWords; ++w) block[w] |= mask[w];
 }
 
 void BloomFilter::add(const std::string& key) {
     if (m_bits_ == 0 || k_hashes_ == 0) return;
 
+    if (format_ != Format::kWholeArray) {
+        add_hash(format_ == Format::kBlocked ? key_hash::value(key) : hash64(key, 0xA5A5A5A5A5A5A5A5ULL));
+        return;
+    }
+
     // double hashing: h1 + i*h2
     const uint64_t h1 = hash64(key, 0xA5A5A5A5A5A5A5A5ULL);
     const uint64_t h2 = hash64(key, 0x5A5A5A5A5A5A5A5AULL) | 1ULL;
@@ -58,8 +94,23 @@ void BloomFilter::add(const std::string& key) {
 }
 
 bool BloomFilter::possibly_contains(const std::string& key) const {
+    return possibly_contains(key, format_ == Format::kBlocked ? key_hash::value(key) : 0);
+}
+
+bool BloomFilter::possibly_contains(std::string_view key, uint64_t hash) const {
     if (m_bits_ == 0 || k_hashes_ == 0) return true; // conservative
 
+    if (format_ != Format::kWholeArray) {
+        const uint64_t h = format_ == Format::kBlocked ? hash : hash64(key, 0xA5A5A5A5A5A5A5A5ULL);
+        uint64_t mask[kBlockWords];
+        block_mask_(h, mask);
+        // branch-free over the whole line so it vectorizes
+        const uint64_t* block = bits_.data() + block_offset_(h);
+        uint64_t missing = 0;
+        for (uint32_t w = 0; w < kBlockWords; ++w) missing |= mask[w] & ~block[w];
+        return missing == 0;
+    }
+
     const uint64_t h1 = hash64(key, 0xA5A5A5A5A5A5A5A5ULL);
     const uint64_t h2 = hash64(key, 0x5A5A5A5A5A5A5A5AULL) | 1ULL;
 
@@ -70,40 +121,60 @@ bool BloomFilter::possibly_contains(const std::string& key) const {
     return true;
 }
 
-void BloomFilter::save(const std::string& path) const {
-    std::ofstream out(path, std::ios::binary | std::ios::trunc);
-    if (!out.is_open()) throw std::runtime_error("Failed to open bloom file: " + path);
-
-    const uint32_t magic = 0xB100B100u;
-    const uint32_t nbytes = static_cast<uint32_t>(bits_.size());
-    out.write(reinterpret_cast<const char*>(&magic), 4);
-    out.write(reinterpret_cast<const char*>(&m_bits_), 4);
-    out.write(reinterpret_cast<const char*>(&k_hashes_), 4);
-    out.write(reinterpret_cast<const char*>(&nbytes), 4);
-    if (nbytes) out.write(reinterpret_cast<const char*>(bits_.data()), nbytes);
-    out.flush();
+std::string BloomFilter::encode() const {
+    const uint32_t magic = format_ == Format::kBlocked      ? kBlockedMagic
+                           : format_ == Format::kBlockedFnv ? kBlockedFnvMagic
+                                                            : kWholeArrayMagic;
+    const bool blocked = format_ != Format::kWholeArray;
+    const uint32_t nbytes = blocked ? m_bits_ / 8 : (m_bits_ + 7) / 8;
+
+    std::string out;
+    out.reserve(16 + nbytes);
+    out.append(reinterpret_cast<const char*>(&magic), 4);
+    out.append(reinterpret_cast<const char*>(&m_bits_), 4);
+    out.append(reinterpret_cast<const char*>(&k_hashes_), 4);
+    out.append(reinterpret_cast<const char*>(&nbytes), 4);
+    out.append(reinterpret_cast<const char*>(bits_.data()), nbytes);
+    return out;
 }
 
-BloomFilter BloomFilter::load(const std::string& path, bool& ok) {
+BloomFilter BloomFilter::decode(const std::string& data, bool& ok) {
     ok = false;
-    std::ifstream in(path, std::ios::binary);
-    if (!in.is_open()) return BloomFilter();
+    if (data.size() < 16) return BloomFilter();
 
     uint32_t magic=0, m=0, k=0, nbytes=0;
-    in.read(reinterpret_cast<char*>(&magic), 4);
-    in.read(reinterpret_cast<char*>(&m), 4);
-    in.read(reinterpret_cast<char*>(&k), 4);
-    in.read(reinterpret_cast<char*>(&nbytes), 4);
-    if (!in || magic != 0xB100B100u) return BloomFilter();
-
-    BloomFilter bf(m, k);
-    if (nbytes != bf.bits_.size()) return BloomFilter();
-
-    if (nbytes) {
-        in.read(reinterpret_cast<char*>(bf.bits_.data()), nbytes);
-        if (!in) return BloomFilter();
+    std::memcpy(&magic, data.data(), 4);
+    std::memcpy(&m, data.data() + 4, 4);
+    std::memcpy(&k, data.data() + 8, 4);
+    std::memcpy(&nbytes, data.data() + 12, 4);
+    BloomFilter bf;
+    if (magic == kBlockedMagic) bf.format_ = Format::kBlocked;
+    else if (magic == kBlockedFnvMagic) bf.format_ = Format::kBlockedFnv;
+    else if (magic == kWholeArrayMagic) bf.format_ = Format::kWholeArray;
+    else return BloomFilter();
+
+    if (m != 0 && k != 0) {
+        bf.m_bits_ = m;
+        bf.k_hashes_ = k;
+        const bool blocked = bf.format_ != Format::kWholeArray;
+        if (blocked && m % kBlockBits != 0) return BloomFilter();
+        if (nbytes != (blocked ? m / 8 : (m + 7) / 8)) return BloomFilter();
+        bf.bits_.assign((nbytes + 7) / 8, 0);
+    } else if (nbytes != 0) {
+        return BloomFilter();
     }
+    if (data.size() - 16 != nbytes) return BloomFilter();
+    if (nbytes) std::memcpy(bf.bits_.data(), data.data() + 16, nbytes);
 
     ok = true;
     return bf;
 }
+
+BloomFilter BloomFilter::load(const std::string& path, bool& ok) {
+    ok = false;
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) return BloomFilter();
+
+    std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    return decode(data, ok);
+}
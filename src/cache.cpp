@@ -0,0 +1,80 @@
+#include "cache.hpp"
+#include "block.hpp"
+
+size_t BlockCache::KeyHash::operator()(const Key& k) const {
+    uint64_t h = k.file_id * 0x9E3779B97F4A7C15ULL ^ k.offset;
+    h ^= (h >> 33);
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= (h >> 33);
+    return static_cast<size_t>(h);
+}
+
+BlockCache::BlockCache(size_t capacity_bytes, int shard_bits)
+    : capacity_(capacity_bytes), shard_bits_(shard_bits)
+{
+    if (shard_bits_ < 0) {
+        shard_bits_ = 0;
+        while (shard_bits_ < 4 && (capacity_ >> (shard_bits_ + 1)) >= kMinShardBytes) ++shard_bits_;
+    }
+    const size_t n = size_t{1} << shard_bits_;
+    shards_.reserve(n);
+    for (size_t i = 0; i < n; ++i) {
+        shards_.push_back(std::make_unique<Shard>());
+        shards_.back()->capacity = (capacity_ + n - 1) / n;
+    }
+}
+
+BlockCache::Shard& BlockCache::shard_for(const Key& k) {
+    const uint64_t h = KeyHash{}(k);
+    return *shards_[shard_bits_ == 0 ? 0 : h >> (64 - shard_bits_)];
+}
+
+std::shared_ptr<const Block> BlockCache::lookup(uint64_t file_id, uint64_t offset) {
+    const Key k{file_id, offset};
+    Shard& s = shard_for(k);
+
+    std::lock_guard<std::mutex> lk(s.mu);
+    auto it = s.map.find(k);
+    if (it == s.map.end()) {
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    s.lru.splice(s.lru.begin(), s.lru, it->second);
+    hits_.fetch_add(1, std::memory_order_relaxed);
+    return it->second->block;
+}
+
+void BlockCache::insert(uint64_t file_id, uint64_t offset, std::shared_ptr<const Block> block,
+                        size_t charge) {
+    const Key k{file_id, offset};
+    Shard& s = shard_for(k);
+
+    std::lock_guard<std::mutex> lk(s.mu);
+    auto it = s.map.find(k);
+    if (it != s.map.end()) {
+        s.usage -= it->second->charge;
+        s.lru.erase(it->second);
+        s.map.erase(it);
+    }
+
+    s.lru.push_front(Entry{k, std::move(block), charge});
+    s.map.emplace(k, s.lru.begin());
+    s.usage += charge;
+
+    // the new entry stays even if it alone is over capacity
+    while (s.usage > s.capacity && s.lru.size() > 1) {
+        const Entry& victim = s.lru.back();
+        s.usage -= victim.charge;
+        s.map.erase(victim.key);
+        s.lru.pop_back();
+    }
+}
+
+size_t BlockCache::usage() const {
+    size_t total = 0;
+    for (const auto& s : shards_) {
+        std::lock_guard<std::mutex> lk(s->mu);
+        total += s->usage;
+    }
+    return total;
+}
@@ -0,0 +1,81 @@
+#include "crc32c.hpp"
+
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+#define HELIOS_CRC32C_HW 1
+#endif
+
+namespace crc32c {
+namespace {
+
+constexpr uint32_t kPoly = 0x82F63B78u; // reflected Castagnoli
+
+using Tables = std::array<std::array<uint32_t, 256>, 8>;
+
+constexpr Tables make_tables() {
+    Tables t{};
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k) c = (c >> 1) ^ ((c & 1) ? kPoly : 0);
+        t[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+        for (int s = 1; s < 8; ++s) t[s][i] = (t[s - 1][i] >> 8) ^ t[0][t[s - 1][i] & 0xFF];
+    }
+    return t;
+}
+
+constexpr Tables kTables = make_tables();
+
+uint32_t extend_sw(uint32_t crc, const uint8_t* p, size_t n) {
+    while (n >= 8) {
+        uint64_t w;
+        std::memcpy(&w, p, 8);
+        w ^= crc;
+        crc = kTables[7][w & 0xFF] ^ kTables[6][(w >> 8) & 0xFF] ^
+              kTables[5][(w >> 16) & 0xFF] ^ kTables[4][(w >> 24) & 0xFF] ^
+              kTables[3][(w >> 32) & 0xFF] ^ kTables[2][(w >> 40) & 0xFF] ^
+              kTables[1][(w >> 48) & 0xFF] ^ kTables[0][w >> 56];
+        p += 8;
+        n -= 8;
+    }
+    while (n--) crc = (crc >> 8) ^ kTables[0][(crc ^ *p++) & 0xFF];
+    return crc;
+}
+
+#ifdef HELIOS_CRC32C_HW
+__attribute__((target("sse4.2")))
+uint32_t extend_hw(uint32_t crc, const uint8_t* p, size_t n) {
+    uint64_t c = crc;
+    while (n >= 8) {
+        uint64_t w;
+        std::memcpy(&w, p, 8);
+        c = _mm_crc32_u64(c, w);
+        p += 8;
+        n -= 8;
+    }
+    uint32_t c32 = static_cast<uint32_t>(c);
+    while (n--) c32 = _mm_crc32_u8(c32, *p++);
+    return c32;
+}
+
+const bool kHasHw = __builtin_cpu_supports("sse4.2");
+#endif
+
+} // namespace
+
+uint32_t extend(uint32_t crc, const void* data, size_t n) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    crc = ~crc;
+#ifdef HELIOS_CRC32C_HW
+    crc = kHasHw ? extend_hw(crc, p, n) : extend_sw(crc, p, n);
+#else
+    crc = extend_sw(crc, p, n);
+#endif
+    return ~crc;
+}
+
+} // namespace crc32c
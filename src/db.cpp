@@ -1,6 +1,14 @@
 #include "db.hpp"
 #include "wal.hpp"
 #include "sstable.hpp"
+#include "memtable.hpp"
+#include "write_batch.hpp"
+#include "cache.hpp"
+#include "merging_iterator.hpp"
+#include "thread_pool.hpp"
+#include "rate_limiter.hpp"
+#include "manifest.hpp"
+#include "key_hash.hpp"
 
 #include <filesystem>
 #include <fstream>
@@ -8,6 +16,9 @@
 #include <algorithm>
 #include <iomanip>
 #include <limits>
+#include <stdexcept>
+#include <chrono>
+#include <cmath>
 
 using namespace std;
 
@@ -15,18 +26,53 @@ static bool starts_with(const std::string& s, const std::string& p) {
     return s.size() >= p.size() && std::equal(p.begin(), p.end(), s.begin());
 }
 
-HeliosDB::HeliosDB(const std::string& data_dir)
-    : data_directory_(data_dir),
-      manifest_path_(data_dir + "/manifest.txt")
+// sst_NNNNNN.dat -> NNNNNN, or 0 if f is not named like that
+static uint64_t sst_file_id(const std::string& f) {
+    if (!starts_with(f, "sst_") || f.size() < 10) return 0;
+    try { return std::stoull(f.substr(4, 6)); } catch (...) { return 0; }
+}
+
+static std::string file_name_of(const SSTable& t) {
+    return std::filesystem::path(t.path()).filename().string();
+}
+
+HeliosDB::HeliosDB(const std::string& data_dir, const Options& options)
+    : options_(options),
+      data_directory_(data_dir),
+      prefix_extractor_(options.prefix_delimiter, options.prefix_delimiter_count),
+      memtable_(std::make_shared<MemTable>(prefix_extractor_))
 {
+    if (options_.num_levels < 2) throw std::runtime_error("Options::num_levels must be at least 2");
+    if (options_.block_cache_bytes > 0) {
+        block_cache_ = std::make_unique<BlockCache>(options_.block_cache_bytes);
+    }
+    rate_limiter_ = std::make_unique<RateLimiter>(options_.rate_limit_bytes_per_sec,
+                                                  options_.rate_limit_auto_tune);
     std::filesystem::create_directories(data_directory_);
     load_manifest_and_sstables_();
+    recover_wal_();
+    install_read_view_unsafe_();
 
-    wal_ = std::make_unique<WAL>(data_directory_ + "/wal.log");
-    wal_->replay(*this);
+    pool_ = std::make_unique<ThreadPool>(options_.max_background_flushes,
+                                         options_.max_background_compactions);
+    {
+        std::unique_lock lock(mutex_);
+        // the memtable recovered from the WAL; if this fails, the error is
+        // in stats() and the segments stay for the next open
+        maybe_schedule_flush_unsafe_();
+        imm_cv_.wait(lock, [&] { return bg_failed_.load() || imm_.empty(); });
 
-    // background compaction thread
-    bg_ = std::thread([this] { bg_loop_(); });
+        // a backlog left from the last run would otherwise stall the first
+        // write until a flush happens to schedule compaction
+        update_write_stall_unsafe_();
+        if (write_stall_.load() != WriteStall::kNone) maybe_schedule_compaction_unsafe_();
+    }
+    if (options_.wal_mode == WalMode::kPeriodic) {
+        sync_bg_ = std::thread([this] { sync_loop_(); });
+    }
+    if (options_.background_verify) {
+        verify_bg_ = std::thread([this] { verify_tables_(); });
+    }
 }
 
 HeliosDB::~HeliosDB() {
@@ -34,86 +80,363 @@ HeliosDB::~HeliosDB() {
 }
 
 void HeliosDB::close() {
-    // stop background thread
-    stop_.store(true);
+    if (stop_.load()) return;
+
+    // Writes that bypassed the WAL only exist in memory. If the flush fails
+    // they are lost; the error is in stats() until then.
+    if (options_.wal_mode == WalMode::kDisabled || unlogged_writes_.load()) {
+        try {
+            flush();
+        } catch (const std::exception&) {
+        }
+    }
+
+    // stop background threads
+    {
+        std::unique_lock lock(mutex_);
+        stop_.store(true);
+    }
+    imm_cv_.notify_all();
     {
-        std::lock_guard<std::mutex> lk(bg_mu_);
-        compact_requested_.store(true);
+        std::lock_guard<std::mutex> lk(stall_mu_);
+    }
+    stall_cv_.notify_all();
+    {
+        std::lock_guard<std::mutex> lk(sync_mu_);
+    }
+    sync_cv_.notify_all();
+    // running jobs finish; queued ones are dropped (their memtables are
+    // still in the WAL)
+    pool_->shutdown();
+    if (sync_bg_.joinable()) sync_bg_.join();
+    if (verify_bg_.joinable()) verify_bg_.join();
+}
+
+void HeliosDB::verify_tables_() {
+    // This runs on its own thread, outside the pool: an exception must not
+    // escape it.
+    try {
+        std::vector<std::pair<int, std::string>> files;
+        {
+            std::shared_lock lock(mutex_);
+            const auto& levels = manifest_->levels();
+            for (int level = 0; level < static_cast<int>(levels.size()); ++level) {
+                for (const auto& f : levels[level]) files.emplace_back(level, f);
+            }
+        }
+
+        for (const auto& [level, f] : files) {
+            if (stop_.load()) return;
+            if (SSTable::is_valid(data_directory_ + "/" + f)) continue;
+
+            // Drop it the way recovery drops a table that fails to open,
+            // unless a compaction already replaced it.
+            std::unique_lock lock(mutex_);
+            if (!manifest_->contains(level, f)) continue;
+
+            VersionEdit edit;
+            edit.deleted.emplace_back(level, f);
+            apply_edit_unsafe_(edit);
+            update_write_stall_unsafe_();
+        }
+    } catch (const std::exception& e) {
+        std::unique_lock lock(mutex_);
+        set_bg_error_unsafe_(std::string("verify: ") + e.what());
+    }
+}
+
+void HeliosDB::sync_loop_() {
+    const auto interval = std::chrono::milliseconds(options_.wal_sync_interval_ms);
+    std::unique_lock<std::mutex> lk(sync_mu_);
+    while (!sync_cv_.wait_for(lk, interval, [&] { return stop_.load(); })) {
+        lk.unlock();
+        std::string error;
+        {
+            std::shared_lock lock(mutex_);
+            try {
+                wal_->sync();
+            } catch (const std::exception& e) {
+                error = e.what();
+            }
+        }
+        if (!error.empty()) {
+            std::unique_lock lock(mutex_);
+            set_bg_error_unsafe_(error);
+            return;
+        }
+        lk.lock();
     }
-    cv_.notify_all();
-    if (bg_.joinable()) bg_.join();
 }
 
-size_t HeliosDB::kv_bytes_(const std::string& k, const std::optional<std::string>& v) {
-    return k.size() + (v ? v->size() : 0) + 16;
+void HeliosDB::recover_wal_() {
+    namespace fs = std::filesystem;
+
+    // Older data dirs have a single unsegmented log; replay it first.
+    const std::string legacy = data_directory_ + "/wal.log";
+    if (fs::exists(legacy)) fs::rename(legacy, data_directory_ + "/" + make_wal_filename_(0));
+
+    std::vector<uint64_t> logs;
+    for (const auto& e : fs::directory_iterator(data_directory_)) {
+        const std::string f = e.path().filename().string();
+        if (starts_with(f, "wal_") && f.size() == 14 && f.ends_with(".log")) {
+            try { logs.push_back(std::stoull(f.substr(4, 6))); } catch (...) {}
+        }
+    }
+    std::sort(logs.begin(), logs.end());
+
+    // Segments below the manifest's log number were flushed; a crash
+    // before they were deleted leaves them behind.
+    while (!logs.empty() && logs.front() < manifest_->log_number()) {
+        fs::remove(data_directory_ + "/" + make_wal_filename_(logs.front()));
+        logs.erase(logs.begin());
+    }
+
+    for (uint64_t n : logs) {
+        WAL::replay(data_directory_ + "/" + make_wal_filename_(n), *this);
+    }
+
+    // What the old segments held is flushed as soon as the pool is up,
+    // which deletes them; otherwise every open would replay them again.
+    // Segments with nothing left to replay go now.
+    log_number_ = logs.empty() ? std::max<uint64_t>(manifest_->log_number(), 1) : logs.back() + 1;
+    min_log_number_ = log_number_;
+    if (!memtable_->empty()) {
+        imm_.push_back({memtable_, logs.back()});
+        memtable_ = std::make_shared<MemTable>(prefix_extractor_);
+        min_log_number_ = logs.front();
+    } else {
+        for (uint64_t n : logs) fs::remove(data_directory_ + "/" + make_wal_filename_(n));
+    }
+    wal_ = std::make_unique<WAL>(data_directory_ + "/" + make_wal_filename_(log_number_));
 }
 
 void HeliosDB::apply_put(const std::string& key, const std::string& value) {
-    std::unique_lock lock(mutex_);
-    auto it = memtable_.find(key);
-    if (it != memtable_.end()) memtable_bytes_ -= kv_bytes_(key, it->second);
-    memtable_[key] = value;
-    memtable_bytes_ += kv_bytes_(key, memtable_[key]);
+    std::shared_lock lock(mutex_);
+    memtable_->add(++last_seq_, key, value);
 }
 
 void HeliosDB::apply_delete(const std::string& key) {
-    std::unique_lock lock(mutex_);
-    auto it = memtable_.find(key);
-    if (it != memtable_.end()) memtable_bytes_ -= kv_bytes_(key, it->second);
-    memtable_[key] = std::nullopt;
-    memtable_bytes_ += kv_bytes_(key, memtable_[key]);
+    std::shared_lock lock(mutex_);
+    memtable_->add(++last_seq_, key, std::nullopt);
 }
 
-void HeliosDB::put(const std::string& key, const std::string& value) {
+void HeliosDB::write_(const WriteOptions& wopts, Writer& w) {
+    delay_write_(w.batch ? w.batch->byte_size()
+                         : w.key->size() + (w.value ? w.value->size() : 0));
+    {
+        std::shared_lock lock(mutex_);
+        check_bg_error_unsafe_();
+
+        w.sync = wopts.sync;
+        if (options_.wal_mode == WalMode::kDisabled || wopts.disable_wal) {
+            // nothing to order against the log
+            w.seq = last_seq_.fetch_add(w.batch ? w.batch->count() : 1) + 1;
+            unlogged_writes_.store(true, std::memory_order_relaxed);
+        } else {
+            std::unique_lock<std::mutex> g(wal_mu_);
+            writers_.push_back(&w);
+            w.cv.wait(g, [&] { return w.done || writers_.front() == &w; });
+            if (!w.done) commit_group_(w, g);
+        }
+        if (!w.error.empty()) {
+            // The WAL stays failed and may end in a torn record: stop taking
+            // writes, the same as after a failed flush or periodic sync.
+            lock.unlock();
+            std::unique_lock ex(mutex_);
+            set_bg_error_unsafe_(w.error);
+            throw std::runtime_error(w.error);
+        }
+
+        if (w.batch) {
+            uint64_t seq = w.seq;
+            w.batch->iterate([&](const std::string& k, const std::string* v) {
+                if (v) memtable_->add(seq++, k, *v);
+                else memtable_->add(seq++, k, std::nullopt);
+            });
+        } else if (w.value) {
+            memtable_->add(w.seq, *w.key, *w.value);
+        } else {
+            memtable_->add(w.seq, *w.key, std::nullopt);
+        }
+
+        if (memtable_->approximate_bytes() < kMaxMemtableBytes) return;
+    }
+
     std::unique_lock lock(mutex_);
-    wal_->append_put(key, value);
+    maybe_flush_unsafe_(lock);
+}
 
-    auto it = memtable_.find(key);
-    if (it != memtable_.end()) memtable_bytes_ -= kv_bytes_(key, it->second);
-    memtable_[key] = value;
-    memtable_bytes_ += kv_bytes_(key, memtable_[key]);
+void HeliosDB::commit_group_(Writer& leader, std::unique_lock<std::mutex>& g) {
+    // Take everyone queued so far. Sequence numbers follow queue order, which
+    // is also the order of the records in the WAL.
+    group_buf_.clear();
+    size_t n = 0;
+    bool sync = options_.wal_mode == WalMode::kSync;
+    for (Writer* w : writers_) {
+        if (n > 0 && group_buf_.size() >= kMaxGroupBytes) break;
+        if (w->batch) WAL::encode_batch(group_buf_, *w->batch);
+        else if (w->value) WAL::encode_put(group_buf_, *w->key, *w->value);
+        else WAL::encode_delete(group_buf_, *w->key);
+        w->seq = last_seq_.fetch_add(w->batch ? w->batch->count() : 1) + 1;
+        sync = sync || w->sync;
+        ++n;
+    }
+
+    wal_groups_.fetch_add(1, std::memory_order_relaxed);
+    wal_group_writes_.fetch_add(n, std::memory_order_relaxed);
+
+    // Writers arriving now queue behind the group; the write itself runs
+    // unlocked. group_buf_ is only touched by the current leader.
+    g.unlock();
+    std::string error;
+    try {
+        wal_->add_records(group_buf_, sync);
+    } catch (const std::exception& e) {
+        error = e.what();
+    }
+    g.lock();
 
-    maybe_flush_unsafe_();
+    for (size_t i = 0; i < n; ++i) {
+        Writer* w = writers_.front();
+        writers_.pop_front();
+        w->error = error;
+        if (w != &leader) {
+            w->done = true;
+            w->cv.notify_one();
+        }
+    }
+    if (!writers_.empty()) writers_.front()->cv.notify_one();
 }
 
-void HeliosDB::del(const std::string& key) {
-    std::unique_lock lock(mutex_);
-    wal_->append_delete(key);
+void HeliosDB::put(const std::string& key, const std::string& value,
+                   const WriteOptions& wopts) {
+    Writer w;
+    w.key = &key;
+    w.value = &value;
+    write_(wopts, w);
+}
 
-    auto it = memtable_.find(key);
-    if (it != memtable_.end()) memtable_bytes_ -= kv_bytes_(key, it->second);
-    memtable_[key] = std::nullopt;
-    memtable_bytes_ += kv_bytes_(key, memtable_[key]);
+void HeliosDB::del(const std::string& key, const WriteOptions& wopts) {
+    Writer w;
+    w.key = &key;
+    write_(wopts, w);
+}
 
-    maybe_flush_unsafe_();
+void HeliosDB::write(const WriteBatch& batch, const WriteOptions& wopts) {
+    if (batch.empty()) return;
+    Writer w;
+    w.batch = &batch;
+    write_(wopts, w);
 }
 
 std::optional<std::string> HeliosDB::get(const std::string& key) {
-    {
-        std::shared_lock lock(mutex_);
-        auto it = memtable_.find(key);
-        if (it != memtable_.end()) {
-            if (!it->second.has_value()) return std::nullopt;
-            return it->second.value();
-        }
+    const std::shared_ptr<const ReadView> view = read_view_.load();
+
+    // newest first: memtable, immutable memtables, then the tables
+    auto v = view->mem->get(key);
+    if (v.has_value()) return v.value();
+    for (const auto& mem : view->imm) {
+        v = mem->get(key);
+        if (v.has_value()) return v.value();
     }
 
-    // newest -> oldest
-    for (const auto& sst : sstables_) {
-        auto v = sst->get(key);
-        if (v.has_value()) {
-            const auto& inner = v.value();
-            if (!inner.has_value()) return std::nullopt;
-            return inner.value();
-        }
+    const auto& version = view->version;
+    const uint64_t hash = key_hash::value(key); // for every table's filter
+
+    // L0 tables may overlap: newest -> oldest
+    for (const auto& sst : version->levels[0]) {
+        v = sst->get(key, hash);
+        if (v.has_value()) return v.value();
+    }
+
+    // below L0 only the table whose range covers key can hold it
+    for (size_t level = 1; level < version->levels.size(); ++level) {
+        const auto& tables = version->levels[level];
+        auto it = std::lower_bound(
+            tables.begin(), tables.end(), key,
+            [](const auto& t, const std::string& k) { return t->largest() < k; }
+        );
+        if (it == tables.end() || key < (*it)->smallest()) continue;
+
+        v = (*it)->get(key, hash);
+        if (v.has_value()) return v.value();
     }
     return std::nullopt;
 }
 
-void HeliosDB::maybe_flush_unsafe_() {
-    if (memtable_bytes_ >= kMaxMemtableBytes) {
-        flush_unsafe_();
+std::vector<std::pair<std::string, std::string>> HeliosDB::scan_prefix(const std::string& prefix) {
+    const std::shared_ptr<const ReadView> view = read_view_.load();
+
+    // Every key starting with prefix has the same extracted prefix as it,
+    // if it has one at all; otherwise no filter can rule anything out.
+    const auto filter_prefix = prefix_extractor_.prefix(prefix);
+    const uint64_t hash = filter_prefix ? key_hash::value(*filter_prefix) : 0;
+    const std::string extractor = prefix_extractor_.name();
+
+    // newest first, as MergingIterator wants
+    std::vector<std::unique_ptr<KVIterator>> iters;
+    auto add_mem = [&](const std::shared_ptr<MemTable>& mem) {
+        if (filter_prefix && !mem->may_contain_prefix(hash)) return;
+        iters.push_back(std::make_unique<MemTable::Iterator>(*mem));
+    };
+    auto add_table = [&](const std::shared_ptr<SSTable>& t) {
+        const bool in_range = t->largest() >= prefix &&
+                              (t->smallest() < prefix || starts_with(t->smallest(), prefix));
+        if (!in_range || (filter_prefix && !t->may_contain_prefix(extractor, *filter_prefix, hash))) {
+            prefix_scan_tables_skipped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        iters.push_back(std::make_unique<SSTable::Iterator>(*t, true));
+    };
+    add_mem(view->mem);
+    for (const auto& mem : view->imm) add_mem(mem);
+    for (const auto& level : view->version->levels) {
+        for (const auto& t : level) add_table(t);
+    }
+
+    std::vector<std::pair<std::string, std::string>> out;
+    MergingIterator it(std::move(iters));
+    for (it.seek(prefix); it.valid() && starts_with(it.key(), prefix); it.next()) {
+        if (it.value()) out.emplace_back(it.key(), *it.value());
+    }
+    if (it.corrupted()) throw std::runtime_error("Corrupt block in scan_prefix");
+    return out;
+}
+
+void HeliosDB::maybe_flush_unsafe_(std::unique_lock<std::shared_mutex>& lock) {
+    if (memtable_->approximate_bytes() < kMaxMemtableBytes) return;
+
+    // Stall only if flushing is behind by kMaxImmutableMemtables.
+    if (imm_.size() >= kMaxImmutableMemtables) {
+        const auto start = std::chrono::steady_clock::now();
+        imm_cv_.wait(lock, [&] {
+            return stop_.load() || bg_failed_.load() || imm_.size() < kMaxImmutableMemtables;
+        });
+        write_stop_micros_ += std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        check_bg_error_unsafe_();
     }
+
+    // another writer may have switched it while we waited
+    if (memtable_->approximate_bytes() < kMaxMemtableBytes) return;
+    switch_memtable_unsafe_(lock);
+}
+
+void HeliosDB::switch_memtable_unsafe_(std::unique_lock<std::shared_mutex>&) {
+    if (memtable_->empty()) return;
+
+    // kPeriodic may still owe the retiring segment a sync
+    if (options_.wal_mode == WalMode::kPeriodic) wal_->sync();
+
+    // the new segment first, so a failure to create it changes nothing
+    auto wal = std::make_unique<WAL>(data_directory_ + "/" + make_wal_filename_(log_number_ + 1));
+    imm_.push_back({memtable_, log_number_});
+    memtable_ = std::make_shared<MemTable>(prefix_extractor_);
+    log_number_++;
+    wal_ = std::move(wal);
+    install_read_view_unsafe_();
+
+    maybe_schedule_flush_unsafe_();
 }
 
 std::string HeliosDB::make_sstable_filename_(uint64_t id) const {
@@ -122,207 +445,877 @@ std::string HeliosDB::make_sstable_filename_(uint64_t id) const {
     return oss.str();
 }
 
-std::vector<std::string> HeliosDB::read_manifest_files_() const {
-    std::vector<std::string> files;
-    std::ifstream in(manifest_path_);
-    std::string line;
-    while (std::getline(in, line)) {
-        if (!line.empty()) files.push_back(line);
-    }
-    return files;
+std::string HeliosDB::make_wal_filename_(uint64_t number) const {
+    std::ostringstream oss;
+    oss << "wal_" << std::setw(6) << std::setfill('0') << number << ".log";
+    return oss.str();
 }
 
-void HeliosDB::write_manifest_atomic_(const std::vector<std::string>& files) {
-    const std::string tmp = manifest_path_ + ".tmp";
-    {
-        std::ofstream out(tmp, std::ios::trunc);
-        for (const auto& f : files) out << f << "\n";
-        out.flush();
+void HeliosDB::apply_edit_unsafe_(const VersionEdit& edit) {
+    ManifestEdit logged;
+    logged.deleted = edit.deleted;
+    for (const auto& [level, table] : edit.added) logged.added.emplace_back(level, file_name_of(*table));
+    logged.next_file_id = next_sst_id_;
+    logged.log_number = edit.log_number;
+    manifest_->log_and_apply(logged);
+
+    auto v = std::make_shared<Version>(*current_);
+
+    std::optional<size_t> l0_pos;
+    for (const auto& [level, file] : edit.deleted) {
+        const std::string path = data_directory_ + "/" + file;
+        auto& tables = v->levels[level];
+        auto it = std::find_if(tables.begin(), tables.end(),
+                               [&](const auto& t) { return t->path() == path; });
+        if (it == tables.end()) continue;
+        const size_t pos = it - tables.begin();
+        if (level == 0) l0_pos = std::min(l0_pos.value_or(pos), pos);
+        tables.erase(it);
+    }
+    size_t l0_insert = l0_pos.value_or(0);
+
+    for (const auto& [level, table] : edit.added) {
+        auto& tables = v->levels[level];
+        if (level == 0) {
+            tables.insert(tables.begin() + l0_insert++, table);
+            continue;
+        }
+        auto it = std::lower_bound(
+            tables.begin(), tables.end(), table->smallest(),
+            [](const auto& t, const std::string& k) { return t->smallest() < k; });
+        tables.insert(it, table);
     }
-    std::filesystem::rename(tmp, manifest_path_);
+    current_ = std::move(v);
+    install_read_view_unsafe_();
+}
+
+void HeliosDB::install_read_view_unsafe_() {
+    auto view = std::make_shared<ReadView>();
+    view->mem = memtable_;
+    for (auto it = imm_.rbegin(); it != imm_.rend(); ++it) view->imm.push_back(it->mem);
+    view->version = current_;
+    read_view_.store(std::move(view));
 }
 
 void HeliosDB::load_manifest_and_sstables_() {
-    if (!std::filesystem::exists(manifest_path_)) {
-        std::ofstream(manifest_path_).close();
-        next_sst_id_ = 1;
-        return;
+    auto version = std::make_shared<Version>();
+    auto& levels = version->levels;
+    levels.resize(options_.num_levels);
+    compact_pointer_.resize(options_.num_levels);
+
+    manifest_ = std::make_unique<Manifest>(data_directory_, options_.num_levels,
+                                           options_.max_manifest_file_size);
+    next_sst_id_ = manifest_->next_file_id();
+    for (const auto& files : manifest_->levels()) {
+        for (const auto& f : files) next_sst_id_ = std::max(next_sst_id_, sst_file_id(f) + 1);
     }
 
-    auto files = read_manifest_files_();
+    // tables from before the block format are rewritten once, in place
+    for (const auto& files : manifest_->levels()) {
+        for (const auto& f : files) {
+            std::string path = data_directory_ + "/" + f;
+            if (std::filesystem::exists(path)) SSTable::upgrade_legacy(path);
+        }
+    }
 
-    for (const auto& f : files) {
-        if (starts_with(f, "sst_") && f.size() >= 10) {
-            std::string num = f.substr(4, 6);
-            uint64_t id = 0;
-            try { id = std::stoull(num); } catch (...) { id = 0; }
-            next_sst_id_ = std::max(next_sst_id_, id + 1);
+    // Opening a table checks its footer and meta blocks; data blocks are
+    // checked lazily as they are read. Tables older than format v3 have no
+    // block checksums, so they still get a full pass here.
+    ManifestEdit dropped;
+    for (int level = 0; level < options_.num_levels; ++level) {
+        for (const auto& f : manifest_->levels()[level]) {
+            std::string path = data_directory_ + "/" + f;
+            if (std::filesystem::exists(path)) {
+                auto table = std::make_shared<SSTable>(path, block_cache_.get(), sst_file_id(f),
+                                                       rate_limiter_.get());
+                if (table->valid() && (table->format_version() >= 3 || SSTable::is_valid(path))) {
+                    levels[level].push_back(std::move(table));
+                    continue;
+                }
+            }
+            dropped.deleted.emplace_back(level, f);
         }
     }
+    for (size_t level = 1; level < levels.size(); ++level) {
+        std::sort(levels[level].begin(), levels[level].end(),
+                  [](const auto& a, const auto& b) { return a->smallest() < b->smallest(); });
+    }
+    current_ = std::move(version);
 
-    std::vector<std::unique_ptr<SSTable>> loaded;
-    for (const auto& f : files) {
-        std::string path = data_directory_ + "/" + f;
-        if (std::filesystem::exists(path) && SSTable::is_valid(path)) {
-            loaded.push_back(std::make_unique<SSTable>(path));
+    if (!dropped.deleted.empty()) manifest_->log_and_apply(dropped);
+}
+
+void HeliosDB::maybe_schedule_flush_unsafe_() {
+    // one job per memtable, oldest first
+    const int max_flushes = std::max(options_.max_background_flushes, 1);
+    for (auto& imm : imm_) {
+        if (stop_.load() || bg_failed_.load() || running_flushes_ >= max_flushes) return;
+        if (imm.flushing) continue;
+        imm.flushing = true;
+        ++running_flushes_;
+        const uint64_t id = next_sst_id_++;
+        const double bits = filter_bits_per_key_unsafe_(0, imm.mem->num_entries());
+        pool_->schedule([this, mem = imm.mem, id, bits] { background_flush_(mem, id, bits); },
+                        ThreadPool::Priority::kHigh);
+    }
+}
+
+void HeliosDB::background_flush_(std::shared_ptr<MemTable> mem, uint64_t id,
+                                 double filter_bits_per_key) {
+    // Build the table without the lock; reads keep finding these entries
+    // in imm_ until it is installed below.
+    const std::string path = data_directory_ + "/" + make_sstable_filename_(id);
+    std::shared_ptr<SSTable> table;
+    try {
+        SSTable::Builder builder(path, mem->num_entries(), options_.filter_type, filter_bits_per_key,
+                                 rate_limiter_.get(), RateLimiter::Priority::kHigh, prefix_extractor_);
+        for (MemTable::Iterator it(*mem); it.valid(); it.next()) {
+            builder.add(it.key(), it.value());
         }
+        builder.finish();
+        flush_bytes_written_ += builder.file_size();
+        table = std::make_shared<SSTable>(path, block_cache_.get(), id, rate_limiter_.get());
+        if (!table->valid()) throw std::runtime_error("Failed to open SSTable: " + path);
+    } catch (const std::exception& e) {
+        // mem stays in imm_ for reads, and in its WAL segments for the
+        // next open
+        std::unique_lock lock(mutex_);
+        --running_flushes_;
+        for (auto& imm : imm_) {
+            if (imm.mem == mem) imm.flushing = false;
+        }
+        set_bg_error_unsafe_(std::string("flush: ") + e.what());
+        return;
     }
-    std::reverse(loaded.begin(), loaded.end());
-    sstables_ = std::move(loaded);
 
-    // clean manifest
-    std::vector<std::string> cleaned;
-    for (const auto& f : files) {
-        std::string path = data_directory_ + "/" + f;
-        if (std::filesystem::exists(path) && SSTable::is_valid(path)) cleaned.push_back(f);
+    std::unique_lock lock(mutex_);
+    --running_flushes_;
+    for (auto& imm : imm_) {
+        if (imm.mem == mem) imm.table = std::move(table);
     }
-    if (cleaned != files) write_manifest_atomic_(cleaned);
+
+    // Install in age order: a table built ahead of an older memtable's
+    // waits here until that one is done.
+    if (!imm_.empty() && imm_.front().table && !bg_failed_.load()) {
+        VersionEdit edit;
+        uint64_t log_number = 0;
+        size_t done = 0;
+        for (; done < imm_.size() && imm_[done].table; ++done) {
+            edit.added.emplace(edit.added.begin(), 0, imm_[done].table);
+            log_number = imm_[done].log_number;
+        }
+        edit.log_number = log_number + 1;
+        try {
+            apply_edit_unsafe_(edit);
+        } catch (const std::exception& e) {
+            set_bg_error_unsafe_(std::string("flush: ") + e.what());
+            return;
+        }
+        imm_.erase(imm_.begin(), imm_.begin() + done);
+
+        // their WAL segments are now covered by the SSTables
+        for (; min_log_number_ <= log_number; ++min_log_number_) {
+            std::filesystem::remove(data_directory_ + "/" + make_wal_filename_(min_log_number_));
+        }
+        update_write_stall_unsafe_();
+        imm_cv_.notify_all();
+
+        // the new tables may also push a level over its limit or bring a
+        // deletion-heavy table to compact
+        maybe_schedule_compaction_unsafe_();
+    }
+    maybe_schedule_flush_unsafe_();
+}
+
+void HeliosDB::flush() {
+    std::unique_lock lock(mutex_);
+    check_bg_error_unsafe_();
+    imm_cv_.wait(lock, [&] {
+        return stop_.load() || bg_failed_.load() || imm_.size() < kMaxImmutableMemtables;
+    });
+    check_bg_error_unsafe_();
+    switch_memtable_unsafe_(lock);
+    imm_cv_.wait(lock, [&] { return stop_.load() || bg_failed_.load() || imm_.empty(); });
+    check_bg_error_unsafe_();
 }
 
-void HeliosDB::request_compaction_() {
+void HeliosDB::set_bg_error_unsafe_(const std::string& what) {
+    if (bg_failed_.load()) return;
+    bg_error_ = what;
+    bg_failed_.store(true);
+
+    // wake everyone waiting on a flush or compaction that will not come
+    imm_cv_.notify_all();
     {
-        std::lock_guard<std::mutex> lk(bg_mu_);
-        compact_requested_.store(true);
+        std::lock_guard<std::mutex> lk(stall_mu_);
     }
-    cv_.notify_one();
+    stall_cv_.notify_all();
 }
 
-void HeliosDB::flush_unsafe_() {
-    if (memtable_.empty()) return;
+void HeliosDB::check_bg_error_unsafe_() const {
+    if (bg_failed_.load()) throw std::runtime_error("Background error: " + bg_error_);
+}
 
-    const uint64_t id = next_sst_id_++;
-    const std::string filename = make_sstable_filename_(id);
-    const std::string path = data_directory_ + "/" + filename;
+void HeliosDB::set_rate_limit(uint64_t bytes_per_sec) {
+    rate_limiter_->set_bytes_per_second(bytes_per_sec);
+}
 
-    std::vector<std::pair<std::string, std::optional<std::string>>> entries;
-    entries.reserve(memtable_.size());
-    for (const auto& [k, v] : memtable_) entries.push_back({k, v});
+void HeliosDB::compact() {
+    std::unique_lock lock(mutex_);
+    maybe_schedule_compaction_unsafe_();
+}
 
-    SSTable::write_atomic(path, entries);
+DBStats HeliosDB::stats() const {
+    DBStats s;
+    if (block_cache_) {
+        s.block_cache_hits = block_cache_->hits();
+        s.block_cache_misses = block_cache_->misses();
+        s.block_cache_usage = block_cache_->usage();
+    }
 
-    auto files = read_manifest_files_();
-    files.push_back(filename);
-    write_manifest_atomic_(files);
+    std::shared_lock lock(mutex_);
+    for (const auto& tables : current_->levels) {
+        s.files_per_level.push_back(tables.size());
+        for (const auto& t : tables) s.filter_bytes += t->filter_bytes();
+    }
+    s.wal_groups = wal_groups_.load();
+    s.wal_group_writes = wal_group_writes_.load();
+    s.compactions = compactions_.load();
+    s.subcompactions = subcompactions_.load();
+    s.compaction_failures = failed_compactions_.load();
+    s.flush_bytes_written = flush_bytes_written_.load();
+    s.compaction_bytes_written = compaction_bytes_written_.load();
+    s.prefix_scan_tables_skipped = prefix_scan_tables_skipped_.load();
+    s.pending_compaction_bytes = pending_compaction_bytes_.load();
+    s.write_stop_micros = write_stop_micros_.load();
+    s.write_slowdown_micros = write_slowdown_micros_.load();
+    s.rate_limit_bytes_per_sec = rate_limiter_->bytes_per_second();
+    s.background_error = bg_error_;
+    return s;
+}
 
-    sstables_.insert(sstables_.begin(), std::make_unique<SSTable>(path));
+void HeliosDB::delay_write_(size_t bytes) {
+    if (write_stall_.load(std::memory_order_relaxed) == WriteStall::kNone) return;
 
-    memtable_.clear();
-    memtable_bytes_ = 0;
-    wal_->reset();
+    using Clock = std::chrono::steady_clock;
+    auto micros = [](Clock::duration d) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+    };
+    auto stalled = [&] {
+        return !stop_.load() && !bg_failed_.load() && write_stall_.load() == WriteStall::kStopped;
+    };
 
-    if (sstables_.size() >= kCompactThreshold) request_compaction_();
+    std::unique_lock<std::mutex> lk(stall_mu_);
+    const auto start = Clock::now();
+    if (stalled()) {
+        // woken by each failed compaction too, to see whether it ended the
+        // stall one way or the other
+        while (stalled()) {
+            const uint64_t failures = failed_compactions_.load();
+            stall_cv_.wait(lk, [&] { return !stalled() || failed_compactions_.load() != failures; });
+        }
+        write_stop_micros_ += micros(Clock::now() - start);
+    }
+    if (stop_.load() || bg_failed_.load() || write_stall_.load() != WriteStall::kDelayed) return;
+
+    // Writers share one schedule, so it is their total rate that is paced.
+    // Each waits its turn plus the time its own bytes take at the rate.
+    const auto now = Clock::now();
+    next_write_time_ = std::max(next_write_time_, now) +
+        std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(bytes / delayed_write_rate_));
+    stall_cv_.wait_until(lk, next_write_time_, [&] {
+        return stop_.load() || bg_failed_.load() || write_stall_.load() == WriteStall::kNone;
+    });
+    write_slowdown_micros_ += micros(Clock::now() - now);
 }
 
-void HeliosDB::flush() {
+uint64_t HeliosDB::pending_compaction_bytes_unsafe_() const {
+    // Roughly the bytes compaction must rewrite to bring every level back
+    // within its limit.
+    const size_t l0_trigger = std::max(options_.level0_file_num_compaction_trigger, 1);
+    auto level_bytes = [&](int level) {
+        uint64_t bytes = 0;
+        for (const auto& t : current_->levels[level]) bytes += t->file_size();
+        return bytes;
+    };
+
+    if (options_.compaction_style == CompactionStyle::kUniversal) {
+        // every run but the oldest, merged once
+        const auto& runs = current_->levels[0];
+        if (runs.size() < std::max<size_t>(l0_trigger, 2)) return 0;
+        return level_bytes(0) - runs.back()->file_size();
+    }
+
+    // L0 is merged with all of L1; the excess of a deeper level with about
+    // multiplier times as much of the next one.
+    uint64_t pending = 0;
+    if (current_->levels[0].size() >= l0_trigger) pending += level_bytes(0) + level_bytes(1);
+    for (int level = 1; level + 1 < options_.num_levels; ++level) {
+        const uint64_t bytes = level_bytes(level);
+        const uint64_t limit = max_bytes_for_level_(level);
+        if (bytes > limit) pending += (bytes - limit) * (options_.max_bytes_for_level_multiplier + 1);
+    }
+    return pending;
+}
+
+void HeliosDB::update_write_stall_unsafe_() {
+    const uint64_t pending = pending_compaction_bytes_unsafe_();
+    pending_compaction_bytes_ = pending;
+    const double l0 = static_cast<double>(current_->levels[0].size());
+
+    // how far v is from soft (0) to hard (1); < 0 below soft
+    auto progress = [](double v, double soft, double hard) {
+        if (soft <= 0 || v < soft) return -1.0;
+        return hard > soft ? (v - soft) / (hard - soft) : 0.0;
+    };
+    const double p = std::max(
+        progress(l0, options_.level0_slowdown_writes_trigger, options_.level0_stop_writes_trigger),
+        progress(static_cast<double>(pending),
+                 static_cast<double>(options_.soft_pending_compaction_bytes_limit),
+                 static_cast<double>(options_.hard_pending_compaction_bytes_limit)));
+
+    WriteStall state = WriteStall::kNone;
+    if ((options_.level0_stop_writes_trigger > 0 && l0 >= options_.level0_stop_writes_trigger) ||
+        (options_.hard_pending_compaction_bytes_limit > 0 &&
+         pending >= options_.hard_pending_compaction_bytes_limit)) {
+        state = WriteStall::kStopped;
+    } else if (p >= 0 && options_.delayed_write_rate > 0) {
+        state = WriteStall::kDelayed;
+    }
+
+    {
+        std::lock_guard<std::mutex> lk(stall_mu_);
+        // the rate falls linearly to a tenth of delayed_write_rate at the
+        // stop limit
+        delayed_write_rate_ = static_cast<double>(options_.delayed_write_rate) *
+                              (1.0 - 0.9 * std::min(std::max(p, 0.0), 1.0));
+        write_stall_ = state;
+    }
+    stall_cv_.notify_all();
+}
+
+void HeliosDB::maybe_schedule_compaction_unsafe_() {
+    const int max_compactions = std::max(options_.max_background_compactions, 1);
+    while (!stop_.load() && !bg_failed_.load() && running_compactions_ < max_compactions) {
+        auto c = pick_compaction_unsafe_();
+        if (!c) return;
+
+        // newest first: L0 in order, then the output level
+        for (int which = 0; which < 2; ++which) {
+            const auto& tables = current_->levels[which == 0 ? c->level : c->output_level];
+            for (const auto& f : c->inputs[which]) {
+                const std::string path = data_directory_ + "/" + f;
+                for (const auto& t : tables) {
+                    if (t->path() == path) c->tables.push_back(t);
+                }
+            }
+        }
+        uint64_t entries = 0;
+        for (const auto& t : c->tables) entries += t->num_entries();
+        c->filter_bits_per_key = filter_bits_per_key_unsafe_(c->output_level, entries);
+
+        auto job = std::make_shared<const Compaction>(std::move(*c));
+        running_.push_back(job);
+        for (const auto& names : job->inputs) being_compacted_.insert(names.begin(), names.end());
+        ++running_compactions_;
+        pool_->schedule([this, job] { background_compaction_(job); }, ThreadPool::Priority::kLow);
+    }
+}
+
+double HeliosDB::filter_bits_per_key_unsafe_(int level, uint64_t entries) const {
+    // Sorted runs a lookup may probe, by entries: each L0 table and each
+    // deeper level, with the new table's run at least entries.
+    std::vector<uint64_t> runs;
+    uint64_t own = entries;
+    for (const auto& t : current_->levels[0]) runs.push_back(t->num_entries());
+    if (level == 0) runs.push_back(entries);
+    for (int l = 1; l < static_cast<int>(current_->levels.size()); ++l) {
+        uint64_t n = 0;
+        for (const auto& t : current_->levels[l]) n += t->num_entries();
+        if (l == level) own = n = std::max(n, entries);
+        if (n > 0) runs.push_back(n);
+    }
+    double total = 0, n_ln_n = 0;
+    for (uint64_t n : runs) {
+        total += n;
+        n_ln_n += n * std::log(std::max<double>(n, 1));
+    }
+
+    double avg = options_.filter_bits_per_key;
+    if (options_.filter_memory_budget > 0 && total > 0) avg = options_.filter_memory_budget * 8.0 / total;
+    if (!options_.filter_bits_by_level || total == 0) return avg;
+
+    // Minimizing the sum of e^(-bits_i ln2^2) over runs subject to
+    // sum n_i bits_i = avg * total puts every rate at n_i times a constant,
+    // which works out to avg plus (mean of ln n, weighted by n, - ln n_i)
+    // / ln2^2. A run whose rate would reach 1 gets no filter.
+    constexpr double kLn2Sq = 0.4804530139182014;
+    const double bits = avg + (n_ln_n / total - std::log(std::max<double>(own, 1))) / kLn2Sq;
+    return std::clamp(bits, 0.0, kMaxFilterBitsPerKey);
+}
+
+void HeliosDB::background_compaction_(std::shared_ptr<const Compaction> c) {
+    bool ok = false;
+    std::string error;
+    try {
+        ok = run_compaction_(*c);
+    } catch (const std::exception& e) {
+        error = e.what();
+    }
+
     std::unique_lock lock(mutex_);
-    flush_unsafe_();
+    running_.erase(std::find(running_.begin(), running_.end(), c));
+    for (const auto& names : c->inputs) {
+        for (const auto& f : names) being_compacted_.erase(f);
+    }
+    --running_compactions_;
+    const bool failed = !ok || !error.empty();
+
+    // An input that failed a block checksum would be picked again by every
+    // later compaction of its level, and the L0 stall would never clear.
+    // Drop it the way verify_tables_ does; if no input owns up to it, stop.
+    if (!ok && error.empty()) {
+        VersionEdit edit;
+        bool found = false;
+        for (int which = 0; which < 2; ++which) {
+            const int level = which == 0 ? c->level : c->output_level;
+            for (const auto& f : c->inputs[which]) {
+                for (const auto& t : c->tables) {
+                    if (!t->corrupted() || std::filesystem::path(t->path()).filename() != f) continue;
+                    found = true;
+                    if (manifest_->contains(level, f)) edit.deleted.emplace_back(level, f);
+                }
+            }
+        }
+        try {
+            if (!found) throw std::runtime_error("unreadable input");
+            if (!edit.deleted.empty()) apply_edit_unsafe_(edit);
+            ok = true;
+        } catch (const std::exception& e) {
+            error = e.what();
+        }
+    }
+    if (!error.empty()) set_bg_error_unsafe_("compaction: " + error);
+    update_write_stall_unsafe_();
+
+    // Keep going until every level is within its limit
+    if (ok) maybe_schedule_compaction_unsafe_();
+
+    // Stopped writers look at the stall again. If nothing running can
+    // bring L0 back under the stop trigger, they would wait for good:
+    // fail them instead.
+    if (failed) {
+        {
+            std::lock_guard<std::mutex> lk(stall_mu_);
+            ++failed_compactions_;
+        }
+        stall_cv_.notify_all();
+        if (write_stall_.load() == WriteStall::kStopped && running_compactions_ == 0) {
+            set_bg_error_unsafe_("compaction: writes stopped and no compaction can run");
+        }
+    }
 }
 
-void HeliosDB::compact() {
-    request_compaction_();
+uint64_t HeliosDB::max_bytes_for_level_(int level) const {
+    uint64_t bytes = options_.max_bytes_for_level_base;
+    for (int l = 1; l < level; ++l) bytes *= options_.max_bytes_for_level_multiplier;
+    return bytes;
 }
 
-void HeliosDB::bg_loop_() {
-    std::unique_lock<std::mutex> lk(bg_mu_);
-    while (!stop_.load()) {
-        cv_.wait(lk, [&] { return stop_.load() || compact_requested_.load(); });
-        if (stop_.load()) break;
-        compact_requested_.store(false);
+std::vector<std::pair<int, double>> HeliosDB::compaction_scores_unsafe_() const {
+    // L0 is scored by table count, since every L0 table costs each read a
+    // probe; deeper levels by size. The last level has nowhere to go.
+    std::vector<std::pair<int, double>> scores;
+    for (int level = 0; level + 1 < options_.num_levels; ++level) {
+        double score = 0;
+        if (level == 0) {
+            score = static_cast<double>(current_->levels[0].size()) /
+                    std::max(options_.level0_file_num_compaction_trigger, 1);
+        } else {
+            uint64_t bytes = 0;
+            for (const auto& t : current_->levels[level]) bytes += t->file_size();
+            score = static_cast<double>(bytes) / max_bytes_for_level_(level);
+        }
+        if (score >= 1) scores.emplace_back(level, score);
+    }
+    std::stable_sort(scores.begin(), scores.end(),
+                     [](const auto& a, const auto& b) { return a.second > b.second; });
+    return scores;
+}
 
-        lk.unlock();
-        // do one merge at a time
-        compact_once_();
-        lk.lock();
+std::optional<HeliosDB::Compaction> HeliosDB::pick_universal_compaction_unsafe_() const {
+    // every L0 table is a sorted run, newest first
+    const auto& runs = current_->levels[0];
+    const size_t n = runs.size();
+    const size_t trigger = std::max(options_.level0_file_num_compaction_trigger, 2);
+
+    // deeper levels are only non-empty if the DB was once leveled
+    bool deeper_empty = true;
+    for (size_t level = 1; level < current_->levels.size(); ++level) {
+        deeper_empty = deeper_empty && current_->levels[level].empty();
+    }
+
+    auto take = [&](size_t first, size_t count) {
+        Compaction c;
+        c.level = 0;
+        c.output_level = 0;
+        c.bottommost = first + count == n && deeper_empty;
+        for (size_t i = first; i < first + count; ++i) c.inputs[0].push_back(file_name_of(*runs[i]));
+        return c;
+    };
+
+    // Space amplification: at worst everything newer than the oldest run
+    // overwrites it. Past the limit, merge all of it.
+    if (n >= trigger) {
+        uint64_t newer = 0;
+        for (size_t i = 0; i + 1 < n; ++i) newer += runs[i]->file_size();
+        if (newer * 100 >= runs.back()->file_size() * options_.universal_max_size_amplification_percent) {
+            return take(0, n);
+        }
     }
+
+    // A deletion-heavy run is merged with every older run, so the output
+    // is bottommost and its tombstones are dropped.
+    if (deeper_empty) {
+        for (size_t i = 0; i < n; ++i) {
+            if (deletion_heavy_(*runs[i])) return take(i, n - i);
+        }
+    }
+    if (n < trigger) return std::nullopt;
+
+    // Size ratio: from each start, newest first, take following runs while
+    // each is no larger than everything taken so far plus size_ratio%.
+    const size_t min_width = std::max<size_t>(options_.universal_min_merge_width, 2);
+    for (size_t start = 0; start + 1 < n; ++start) {
+        uint64_t sum = runs[start]->file_size();
+        size_t end = start + 1;
+        while (end < n && runs[end]->file_size() * 100 <= sum * (100 + options_.universal_size_ratio)) {
+            sum += runs[end]->file_size();
+            ++end;
+        }
+        if (end - start >= min_width) return take(start, end - start);
+    }
+
+    // Still too many runs: merge the newest ones to get under the trigger.
+    return take(0, n - trigger + 2);
 }
 
-void HeliosDB::compact_once_() {
-    // Snapshot manifest files under DB lock
-    std::vector<std::string> files;
-    {
-        std::unique_lock lock(mutex_);
-        files = read_manifest_files_();
-        if (files.size() < kMergeN) return;
-    }
-
-    // Merge newest kMergeN files: last kMergeN in manifest (manifest oldest->newest)
-    std::vector<std::string> merge_files(files.end() - kMergeN, files.end());
-
-    // Build merged map (oldest->newest so newest wins)
-    std::map<std::string, std::optional<std::string>> merged;
-    const uint32_t TOMBSTONE = std::numeric_limits<uint32_t>::max();
-
-    for (const auto& f : merge_files) {
-        std::string p = data_directory_ + "/" + f;
-        if (!std::filesystem::exists(p) || !SSTable::is_valid(p)) continue;
-
-        std::ifstream in(p, std::ios::binary);
-        if (!in.is_open()) continue;
-
-        auto total = std::filesystem::file_size(p);
-        uint64_t end = static_cast<uint64_t>(total - sizeof(uint64_t) - sizeof(uint32_t)); // footer
-
-        uint64_t off = 0;
-        while (off < end) {
-            in.seekg(static_cast<std::streamoff>(off), std::ios::beg);
-            uint32_t ksize=0, vsize=0;
-            in.read(reinterpret_cast<char*>(&ksize), 4);
-            if (!in) break;
-            in.read(reinterpret_cast<char*>(&vsize), 4);
-            if (!in) break;
-            if (off + 8ULL + ksize > end) break;
-
-            std::string key(ksize, '\0');
-            in.read(key.data(), ksize);
-            if (!in) break;
-
-            if (vsize == TOMBSTONE) {
-                merged[key] = std::nullopt;
-                off = static_cast<uint64_t>(in.tellg());
-            } else {
-                if (off + 8ULL + ksize + vsize > end) break;
-                std::string val(vsize, '\0');
-                in.read(val.data(), vsize);
-                if (!in) break;
-                merged[key] = std::move(val);
-                off = static_cast<uint64_t>(in.tellg());
+std::optional<HeliosDB::Compaction> HeliosDB::pick_compaction_unsafe_() {
+    // Universal merges rewrite L0 runs in place and may take any of them,
+    // so they run one at a time.
+    if (options_.compaction_style == CompactionStyle::kUniversal) {
+        if (!running_.empty()) return std::nullopt;
+        return pick_universal_compaction_unsafe_();
+    }
+
+    // the most urgent level that has work not clashing with a running
+    // compaction
+    for (const auto& [level, score] : compaction_scores_unsafe_()) {
+        if (auto c = pick_level_compaction_unsafe_(level)) return c;
+    }
+
+    // a deletion-heavy L0 table goes down along with the rest of L0
+    const auto& l0 = current_->levels[0];
+    if (std::any_of(l0.begin(), l0.end(), [&](const auto& t) { return deletion_heavy_(*t); })) {
+        if (auto c = pick_level_compaction_unsafe_(0)) return c;
+    }
+    return pick_deletion_compaction_unsafe_();
+}
+
+std::optional<HeliosDB::Compaction> HeliosDB::pick_level_compaction_unsafe_(int level) {
+    Compaction c;
+    c.level = level;
+    c.output_level = level + 1;
+
+    if (level == 0) {
+        // L0 tables overlap each other, so they all go at once
+        if (current_->levels[0].empty()) return std::nullopt;
+        for (const auto& r : running_) {
+            if (r->level == 0) return std::nullopt;
+        }
+        std::string smallest, largest;
+        uint64_t deletions = 0;
+        for (const auto& t : current_->levels[0]) {
+            if (c.inputs[0].empty() || t->smallest() < smallest) smallest = t->smallest();
+            if (c.inputs[0].empty() || t->largest() > largest) largest = t->largest();
+            deletions += t->num_deletions();
+            c.inputs[0].push_back(file_name_of(*t));
+        }
+        if (!setup_compaction_unsafe_(c, smallest, largest, deletions)) return std::nullopt;
+        return c;
+    }
+
+    // the first free table past the compact pointer, wrapping around
+    const auto& tables = current_->levels[level];
+    const std::string& ptr = compact_pointer_[level];
+    const auto start = std::find_if(tables.begin(), tables.end(),
+                                    [&](const auto& t) { return ptr.empty() || t->largest() > ptr; });
+    const size_t first = start - tables.begin();
+    for (size_t i = 0; i < tables.size(); ++i) {
+        const SSTable& t = *tables[(first + i) % tables.size()];
+        c.inputs[0] = {file_name_of(t)};
+        c.inputs[1].clear();
+        if (!setup_compaction_unsafe_(c, t.smallest(), t.largest(), t.num_deletions())) continue;
+        compact_pointer_[level] = t.largest();
+        return c;
+    }
+    return std::nullopt;
+}
+
+bool HeliosDB::deletion_heavy_(const SSTable& t) const {
+    const double ratio = options_.deletion_compaction_ratio;
+    return ratio > 0 && t.num_deletions() > 0 &&
+           static_cast<double>(t.num_deletions()) >= ratio * static_cast<double>(t.num_entries());
+}
+
+std::optional<HeliosDB::Compaction> HeliosDB::pick_deletion_compaction_unsafe_() const {
+    // The table with the highest tombstone density below L0, if it is over
+    // the ratio. It moves down a level; on the last level it is rewritten
+    // in place, which drops its tombstones.
+    const SSTable* best = nullptr;
+    int best_level = 0;
+    double best_density = 0;
+    for (int level = 1; level < options_.num_levels; ++level) {
+        for (const auto& t : current_->levels[level]) {
+            if (!deletion_heavy_(*t) || being_compacted_.count(file_name_of(*t))) continue;
+            const double density = static_cast<double>(t->num_deletions()) / t->num_entries();
+            if (density > best_density) {
+                best = t.get();
+                best_level = level;
+                best_density = density;
             }
         }
     }
+    if (!best) return std::nullopt;
 
-    // Write new merged SSTable
-    uint64_t new_id = 0;
-    std::string out_file;
-    std::string out_path;
-    {
-        std::unique_lock lock(mutex_);
-        new_id = next_sst_id_++;
-        out_file = make_sstable_filename_(new_id);
-        out_path = data_directory_ + "/" + out_file;
+    Compaction c;
+    c.level = best_level;
+    c.output_level = std::min(best_level + 1, options_.num_levels - 1);
+    c.inputs[0].push_back(file_name_of(*best));
+    if (!setup_compaction_unsafe_(c, best->smallest(), best->largest(), best->num_deletions())) {
+        return std::nullopt;
     }
+    return c;
+}
 
-    std::vector<std::pair<std::string, std::optional<std::string>>> entries;
-    entries.reserve(merged.size());
-    for (auto& [k, v] : merged) entries.push_back({k, v});
+bool HeliosDB::setup_compaction_unsafe_(Compaction& c, std::string smallest, std::string largest,
+                                        uint64_t deletions) const {
+    if (c.output_level != c.level) {
+        for (const auto& t : current_->levels[c.output_level]) {
+            if (t->largest() < smallest || t->smallest() > largest) continue;
+            c.inputs[1].push_back(file_name_of(*t));
+            deletions += t->num_deletions();
+            smallest = std::min(smallest, t->smallest());
+            largest = std::max(largest, t->largest());
+        }
+    }
 
-    SSTable::write_atomic(out_path, entries);
+    // Bottommost if no deeper table can hold an older version of any key
+    // in the output's range: then tombstones have nothing left to hide.
+    c.bottommost = true;
+    for (int level = c.output_level + 1; level < options_.num_levels && c.bottommost; ++level) {
+        for (const auto& t : current_->levels[level]) {
+            if (t->largest() < smallest || t->smallest() > largest) continue;
+            c.bottommost = false;
+            break;
+        }
+    }
 
-    // Install: rewrite manifest + delete old files + reload sstables (under lock)
-    {
+    c.trivial_move = c.output_level != c.level && c.inputs[0].size() == 1 &&
+                     c.inputs[1].empty() && !(c.bottommost && deletions > 0);
+    c.smallest = std::move(smallest);
+    c.largest = std::move(largest);
+
+    // A running compaction must not lose an input to this one, nor have
+    // its outputs interleave with ours on the same level.
+    for (const auto& names : c.inputs) {
+        for (const auto& f : names) {
+            if (being_compacted_.count(f)) return false;
+        }
+    }
+    for (const auto& r : running_) {
+        if (r->output_level != c.output_level) continue;
+        if (r->largest < c.smallest || r->smallest > c.largest) continue;
+        return false;
+    }
+    return true;
+}
+
+void HeliosDB::run_subcompaction_(const Compaction& c, uint64_t per_output, Subcompaction& sub) {
+    std::unique_ptr<SSTable::Builder> builder;
+    std::string pending; // output being built
+    try {
+        std::vector<std::unique_ptr<KVIterator>> iters;
+        for (const auto& t : c.tables) iters.push_back(std::make_unique<SSTable::Iterator>(*t));
+        MergingIterator merged(std::move(iters));
+        if (!sub.begin.empty()) merged.seek(sub.begin);
+
+        auto finish_output = [&] {
+            builder->finish();
+            sub.bytes_written += builder->file_size();
+            sub.outputs.push_back(std::move(pending));
+            builder.reset();
+        };
+
+        for (; merged.valid(); merged.next()) {
+            if (!sub.end.empty() && merged.key() >= sub.end) break;
+
+            // nothing older can hold the key, so the tombstone has nothing to hide
+            if (c.bottommost && !merged.value()) continue;
+
+            if (!builder) {
+                {
+                    std::unique_lock lock(mutex_);
+                    pending = make_sstable_filename_(next_sst_id_++);
+                }
+                builder = std::make_unique<SSTable::Builder>(
+                    data_directory_ + "/" + pending, per_output, options_.filter_type,
+                    c.filter_bits_per_key, rate_limiter_.get(), RateLimiter::Priority::kLow,
+                    prefix_extractor_);
+            }
+            builder->add(merged.key(), merged.value());
+            if (c.output_level > 0 && builder->file_size() >= options_.target_file_size) {
+                finish_output();
+            }
+        }
+
+        // a stopped input leaves the unfinished output to its destructor
+        sub.corrupted = merged.corrupted();
+        if (builder && !sub.corrupted) finish_output();
+    } catch (...) {
+        sub.error = std::current_exception();
+    }
+}
+
+bool HeliosDB::run_compaction_(const Compaction& c) {
+    // A lone table with nothing below it to merge with just moves down.
+    if (c.trivial_move) {
         std::unique_lock lock(mutex_);
+        if (!manifest_->contains(c.level, c.inputs[0][0])) return true;
+
+        VersionEdit edit;
+        edit.deleted.emplace_back(c.level, c.inputs[0][0]);
+        edit.added.emplace_back(c.output_level, c.tables[0]);
+        apply_edit_unsafe_(edit);
+        return true;
+    }
 
-        auto cur = read_manifest_files_();
-        if (cur.size() < kMergeN) return;
+    // c.tables are newest first, so the merge keeps their entry on equal
+    // keys. They were checksummed when loaded or written.
+    uint64_t expected_entries = 0;
+    uint64_t input_bytes = 0;
+    for (const auto& t : c.tables) {
+        expected_entries += t->num_entries();
+        input_bytes += t->file_size();
+    }
 
-        std::vector<std::string> new_manifest(cur.begin(), cur.end() - kMergeN);
-        new_manifest.push_back(out_file);
-        write_manifest_atomic_(new_manifest);
+    // Leveled output is split into tables of about target_file_size, and
+    // the bloom of each is sized for its share of the input entries. A
+    // universal run stays one table, since L0 tables are probed one by one.
+    const bool split = c.output_level > 0;
+    const uint64_t per_output = !split ? expected_entries : std::min(
+        expected_entries,
+        expected_entries * options_.target_file_size / std::max<uint64_t>(input_bytes, 1) + 1);
 
-        for (const auto& f : merge_files) {
-            std::filesystem::remove(data_directory_ + "/" + f);
-            std::filesystem::remove(data_directory_ + "/" + f + ".bloom");
+    // Large leveled compactions are cut into disjoint key ranges merged by
+    // their own threads. Split points come from the inputs' index blocks:
+    // every block's last key stands for about one block of data, so taking
+    // them at even intervals gives ranges of similar size.
+    size_t n = 1;
+    if (split && options_.max_subcompactions > 1) {
+        n = std::min<uint64_t>(options_.max_subcompactions,
+                               input_bytes / std::max<uint64_t>(options_.target_file_size, 1));
+    }
+    std::vector<Subcompaction> subs(1);
+    if (n > 1) {
+        std::vector<std::string> keys;
+        for (const auto& t : c.tables) {
+            auto b = t->block_boundaries();
+            keys.insert(keys.end(), std::make_move_iterator(b.begin()), std::make_move_iterator(b.end()));
+        }
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+        n = std::min(n, keys.size());
+        for (size_t i = 1; i < n; ++i) {
+            const std::string& k = keys[i * keys.size() / n];
+            if (k.empty() || k <= subs.back().begin) continue;
+            subs.back().end = k;
+            subs.emplace_back().begin = k;
         }
+    }
 
-        load_manifest_and_sstables_();
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < subs.size(); ++i) {
+        workers.emplace_back([&, i] { run_subcompaction_(c, per_output, subs[i]); });
     }
+    run_subcompaction_(c, per_output, subs[0]);
+    for (auto& w : workers) w.join();
+
+    std::vector<std::string> outputs;
+    uint64_t bytes_written = 0;
+    bool corrupted = false;
+    std::exception_ptr error;
+    for (const auto& sub : subs) {
+        outputs.insert(outputs.end(), sub.outputs.begin(), sub.outputs.end());
+        bytes_written += sub.bytes_written;
+        corrupted = corrupted || sub.corrupted;
+        if (!error) error = sub.error;
+    }
+
+    auto remove_outputs = [&] {
+        std::error_code ec;
+        for (const auto& f : outputs) std::filesystem::remove(data_directory_ + "/" + f, ec);
+    };
+
+    // never replace an input we could only partly read
+    if (corrupted || error) {
+        remove_outputs();
+        if (error) std::rethrow_exception(error);
+        return false;
+    }
+
+    // Opened before taking the lock: the install itself only swaps in a
+    // Version without the inputs and with these.
+    VersionEdit edit;
+    for (const auto& f : outputs) {
+        auto t = std::make_shared<SSTable>(data_directory_ + "/" + f, block_cache_.get(),
+                                           sst_file_id(f), rate_limiter_.get());
+        if (!t->valid()) {
+            remove_outputs();
+            throw std::runtime_error("Failed to open SSTable: " + f);
+        }
+        edit.added.emplace_back(c.output_level, std::move(t));
+    }
+
+    std::unique_lock lock(mutex_);
+
+    // Flushes since the pick only added L0 tables newer than the output,
+    // which stay where they are. Inputs dropped by verify_tables_ meanwhile
+    // abandon the compaction. An L0 output takes the place of its inputs
+    // so the L0 order stays by age.
+    for (int which = 0; which < 2; ++which) {
+        const int level = which == 0 ? c.level : c.output_level;
+        for (const auto& f : c.inputs[which]) {
+            if (!manifest_->contains(level, f)) {
+                remove_outputs();
+                return true;
+            }
+            edit.deleted.emplace_back(level, f);
+        }
+    }
+    try {
+        apply_edit_unsafe_(edit);
+    } catch (...) {
+        remove_outputs();
+        throw;
+    }
+
+    // deleted once no reader or running compaction still holds them
+    for (const auto& t : c.tables) t->mark_obsolete();
+
+    compactions_++;
+    subcompactions_ += subs.size();
+    compaction_bytes_written_ += bytes_written;
+    return true;
 }
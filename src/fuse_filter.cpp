@@ -0,0 +1,225 @@
+#include "fuse_filter.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+static constexpr uint32_t kMagic = 0xF05E0008u; // binary fuse, 8-bit fingerprints
+static constexpr size_t kHeaderSize = 24;       // magic, seed, segment length/count, array length
+static constexpr int kMaxBuildAttempts = 100;
+
+namespace {
+
+uint64_t murmur64(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+uint64_t splitmix64(uint64_t& state) {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+uint64_t mulhi(uint64_t a, uint64_t b) {
+    return static_cast<uint64_t>((static_cast<__uint128_t>(a) * b) >> 64);
+}
+
+uint8_t fingerprint(uint64_t h) { return static_cast<uint8_t>(h ^ (h >> 32)); }
+
+uint8_t mod3(uint8_t x) { return x > 2 ? x - 3 : x; }
+
+} // namespace
+
+void BinaryFuseFilter::size_for_(uint32_t n) {
+    // segment length and array size as recommended for arity 3
+    constexpr uint32_t kArity = 3;
+    segment_length_ = n == 0 ? 4 : 1u << static_cast<int>(std::floor(std::log(n) / std::log(3.33) + 2.25));
+    segment_length_ = std::min<uint32_t>(segment_length_, 1u << 18);
+    segment_length_mask_ = segment_length_ - 1;
+
+    const double size_factor = n <= 1 ? 0 : std::max(1.125, 0.875 + 0.25 * std::log(1000000.0) / std::log(n));
+    const uint32_t capacity = n <= 1 ? 0 : static_cast<uint32_t>(std::round(n * size_factor));
+    const uint32_t init_segments =
+        std::max<int64_t>(static_cast<int64_t>((capacity + segment_length_ - 1) / segment_length_) -
+                              static_cast<int64_t>(kArity - 1), 0);
+    const uint32_t array_length = (init_segments + kArity - 1) * segment_length_;
+    segment_count_ = (array_length + segment_length_ - 1) / segment_length_;
+    segment_count_ = segment_count_ <= kArity - 1 ? 1 : segment_count_ - (kArity - 1);
+    segment_count_length_ = segment_count_ * segment_length_;
+    fingerprints_.assign((segment_count_ + kArity - 1) * segment_length_, 0);
+}
+
+uint32_t BinaryFuseFilter::slot_(int index, uint64_t h) const {
+    uint64_t s = mulhi(h, segment_count_length_) + static_cast<uint64_t>(index) * segment_length_;
+    s ^= ((h & ((1ULL << 36) - 1)) >> (36 - 18 * index)) & segment_length_mask_;
+    return static_cast<uint32_t>(s);
+}
+
+bool BinaryFuseFilter::build(std::vector<uint64_t> hashes) {
+    const uint32_t size = static_cast<uint32_t>(hashes.size());
+    size_for_(size);
+    const uint32_t capacity = static_cast<uint32_t>(fingerprints_.size());
+
+    // Each slot keeps how many keys map to it (count << 2) and the XOR of
+    // their positions 0..2 in the low bits, plus the XOR of their hashes;
+    // a slot with one key left names it, and peeling such slots in turn
+    // orders the keys so each can be assigned a slot of its own.
+    std::vector<uint64_t> order(size + 1);
+    std::vector<uint32_t> alone(capacity);
+    std::vector<uint8_t> t2count(capacity);
+    std::vector<uint8_t> reverse_h(size);
+    std::vector<uint64_t> t2hash(capacity);
+
+    uint32_t block_bits = 1;
+    while ((1u << block_bits) < segment_count_) block_bits++;
+    const uint32_t blocks = 1u << block_bits;
+    std::vector<uint32_t> start(blocks);
+
+    uint64_t rng = 0x726b2b9d438b9d4dULL;
+    seed_ = splitmix64(rng);
+    uint32_t stack_size = 0;
+    for (int attempt = 0;; attempt++) {
+        if (attempt == kMaxBuildAttempts) return false;
+        if (attempt > 0) {
+            std::fill(order.begin(), order.end() - 1, 0);
+            std::fill(t2count.begin(), t2count.end(), 0);
+            std::fill(t2hash.begin(), t2hash.end(), 0);
+            seed_ = splitmix64(rng);
+        }
+        order[size] = 1;
+
+        // sort the hashes roughly by segment, which keeps the counting
+        // below within a few cache lines at a time
+        for (uint32_t i = 0; i < blocks; i++) start[i] = static_cast<uint32_t>((uint64_t(i) * size) >> block_bits);
+        for (uint32_t i = 0; i < size; i++) {
+            const uint64_t h = murmur64(hashes[i] + seed_);
+            uint64_t b = h >> (64 - block_bits);
+            while (order[start[b]] != 0) b = (b + 1) & (blocks - 1);
+            order[start[b]++] = h;
+        }
+
+        bool error = false;
+        uint32_t duplicates = 0;
+        for (uint32_t i = 0; i < size; i++) {
+            const uint64_t h = order[i];
+            const uint32_t h0 = slot_(0, h), h1 = slot_(1, h), h2 = slot_(2, h);
+            t2count[h0] += 4;
+            t2hash[h0] ^= h;
+            t2count[h1] += 4;
+            t2count[h1] ^= 1;
+            t2hash[h1] ^= h;
+            t2count[h2] += 4;
+            t2count[h2] ^= 2;
+            t2hash[h2] ^= h;
+            // the same hash twice cancels out; keep one of them
+            if ((t2hash[h0] & t2hash[h1] & t2hash[h2]) == 0 &&
+                ((t2hash[h0] == 0 && t2count[h0] == 8) || (t2hash[h1] == 0 && t2count[h1] == 8) ||
+                 (t2hash[h2] == 0 && t2count[h2] == 8))) {
+                duplicates++;
+                t2count[h0] -= 4;
+                t2hash[h0] ^= h;
+                t2count[h1] -= 4;
+                t2count[h1] ^= 1;
+                t2hash[h1] ^= h;
+                t2count[h2] -= 4;
+                t2count[h2] ^= 2;
+                t2hash[h2] ^= h;
+            }
+            // a count wrapped past 63 keys
+            error = error || t2count[h0] < 4 || t2count[h1] < 4 || t2count[h2] < 4;
+        }
+        if (error) continue;
+
+        uint32_t queued = 0;
+        for (uint32_t i = 0; i < capacity; i++) {
+            alone[queued] = i;
+            queued += (t2count[i] >> 2) == 1 ? 1 : 0;
+        }
+        stack_size = 0;
+        while (queued > 0) {
+            const uint32_t index = alone[--queued];
+            if ((t2count[index] >> 2) != 1) continue;
+            const uint64_t h = t2hash[index];
+            const uint32_t slots[5] = {slot_(0, h), slot_(1, h), slot_(2, h), slot_(0, h), slot_(1, h)};
+            const uint8_t found = t2count[index] & 3;
+            reverse_h[stack_size] = found;
+            order[stack_size++] = h;
+            for (uint8_t j = 1; j <= 2; j++) {
+                const uint32_t other = slots[found + j];
+                alone[queued] = other;
+                queued += (t2count[other] >> 2) == 2 ? 1 : 0;
+                t2count[other] -= 4;
+                t2count[other] ^= mod3(found + j);
+                t2hash[other] ^= h;
+            }
+        }
+        if (stack_size + duplicates == size) break;
+    }
+
+    // assign in reverse peel order: each key's own slot is still free
+    for (uint32_t i = stack_size; i-- > 0;) {
+        const uint64_t h = order[i];
+        const uint32_t slots[5] = {slot_(0, h), slot_(1, h), slot_(2, h), slot_(0, h), slot_(1, h)};
+        const uint8_t found = reverse_h[i];
+        fingerprints_[slots[found]] =
+            fingerprint(h) ^ fingerprints_[slots[found + 1]] ^ fingerprints_[slots[found + 2]];
+    }
+    return true;
+}
+
+bool BinaryFuseFilter::possibly_contains(uint64_t hash) const {
+    if (fingerprints_.empty()) return true; // conservative
+    const uint64_t h = murmur64(hash + seed_);
+    const uint8_t f = fingerprint(h) ^ fingerprints_[slot_(0, h)] ^ fingerprints_[slot_(1, h)] ^
+                      fingerprints_[slot_(2, h)];
+    return f == 0;
+}
+
+std::string BinaryFuseFilter::encode() const {
+    const uint32_t array_length = static_cast<uint32_t>(fingerprints_.size());
+    std::string out;
+    out.reserve(kHeaderSize + array_length);
+    out.append(reinterpret_cast<const char*>(&kMagic), 4);
+    out.append(reinterpret_cast<const char*>(&seed_), 8);
+    out.append(reinterpret_cast<const char*>(&segment_length_), 4);
+    out.append(reinterpret_cast<const char*>(&segment_count_), 4);
+    out.append(reinterpret_cast<const char*>(&array_length), 4);
+    out.append(reinterpret_cast<const char*>(fingerprints_.data()), array_length);
+    return out;
+}
+
+bool BinaryFuseFilter::is_encoded(const std::string& data) {
+    uint32_t magic = 0;
+    if (data.size() < 4) return false;
+    std::memcpy(&magic, data.data(), 4);
+    return magic == kMagic;
+}
+
+BinaryFuseFilter BinaryFuseFilter::decode(const std::string& data, bool& ok) {
+    ok = false;
+    if (data.size() < kHeaderSize || !is_encoded(data)) return BinaryFuseFilter();
+
+    BinaryFuseFilter f;
+    uint32_t array_length = 0;
+    std::memcpy(&f.seed_, data.data() + 4, 8);
+    std::memcpy(&f.segment_length_, data.data() + 12, 4);
+    std::memcpy(&f.segment_count_, data.data() + 16, 4);
+    std::memcpy(&array_length, data.data() + 20, 4);
+
+    const uint64_t sl = f.segment_length_;
+    if (sl == 0 || (sl & (sl - 1)) != 0 || sl > (1u << 18) || f.segment_count_ == 0) return BinaryFuseFilter();
+    if (static_cast<uint64_t>(f.segment_count_ + 2) * sl != array_length) return BinaryFuseFilter();
+    if (data.size() - kHeaderSize != array_length) return BinaryFuseFilter();
+    f.segment_length_mask_ = f.segment_length_ - 1;
+    f.segment_count_length_ = f.segment_count_ * f.segment_length_;
+    f.fingerprints_.assign(data.begin() + kHeaderSize, data.end());
+
+    ok = true;
+    return f;
+}
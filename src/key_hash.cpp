@@ -0,0 +1,82 @@
+#include "key_hash.hpp"
+
+#include <cstring>
+
+namespace key_hash {
+namespace {
+
+constexpr uint64_t kSecret[4] = {0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL,
+                                 0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL};
+
+inline void mum(uint64_t& a, uint64_t& b) {
+    const __uint128_t r = static_cast<__uint128_t>(a) * b;
+    a = static_cast<uint64_t>(r);
+    b = static_cast<uint64_t>(r >> 64);
+}
+
+inline uint64_t mix(uint64_t a, uint64_t b) {
+    mum(a, b);
+    return a ^ b;
+}
+
+inline uint64_t read64(const uint8_t* p) {
+    uint64_t v;
+    std::memcpy(&v, p, 8);
+    return v;
+}
+
+inline uint64_t read32(const uint8_t* p) {
+    uint32_t v;
+    std::memcpy(&v, p, 4);
+    return v;
+}
+
+// 1..3 bytes
+inline uint64_t read_small(const uint8_t* p, size_t n) {
+    return (static_cast<uint64_t>(p[0]) << 16) | (static_cast<uint64_t>(p[n >> 1]) << 8) | p[n - 1];
+}
+
+} // namespace
+
+uint64_t value(const void* data, size_t n, uint64_t seed) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    seed ^= mix(seed ^ kSecret[0], kSecret[1]);
+
+    uint64_t a = 0, b = 0;
+    if (n <= 16) {
+        if (n >= 4) {
+            const size_t mid = (n >> 3) << 2;
+            a = (read32(p) << 32) | read32(p + mid);
+            b = (read32(p + n - 4) << 32) | read32(p + n - 4 - mid);
+        } else if (n > 0) {
+            a = read_small(p, n);
+        }
+    } else {
+        size_t i = n;
+        if (i > 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = mix(read64(p) ^ kSecret[1], read64(p + 8) ^ seed);
+                see1 = mix(read64(p + 16) ^ kSecret[2], read64(p + 24) ^ see1);
+                see2 = mix(read64(p + 32) ^ kSecret[3], read64(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = mix(read64(p) ^ kSecret[1], read64(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        // the last 16 bytes, overlapping what was already mixed
+        a = read64(p + i - 16);
+        b = read64(p + i - 8);
+    }
+    a ^= kSecret[1];
+    b ^= seed;
+    mum(a, b);
+    return mix(a ^ kSecret[0] ^ n, b ^ kSecret[1]);
+}
+
+} // namespace key_hash
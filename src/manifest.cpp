@@ -0,0 +1,337 @@
+#include "manifest.hpp"
+#include "crc32c.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+// payload field tags
+enum : uint8_t {
+    kNextFileId = 1, // u64
+    kLogNumber = 2,  // u64
+    kDeleted = 3,    // level u32, name len u32, name
+    kAdded = 4,      // level u32, name len u32, name
+};
+
+constexpr size_t kHeaderSize = 8; // len u32, crc32c u32 of the payload
+
+void put_u32(std::string& dst, uint32_t v) { dst.append(reinterpret_cast<const char*>(&v), 4); }
+void put_u64(std::string& dst, uint64_t v) { dst.append(reinterpret_cast<const char*>(&v), 8); }
+
+template <typename T>
+bool get(const char*& p, const char* end, T& v) {
+    if (static_cast<size_t>(end - p) < sizeof(T)) return false;
+    std::memcpy(&v, p, sizeof(T));
+    p += sizeof(T);
+    return true;
+}
+
+void write_all(int fd, const std::string& buf, const std::string& path) {
+#if defined(__unix__) || defined(__APPLE__)
+    const char* p = buf.data();
+    size_t left = buf.size();
+    while (left > 0) {
+        ssize_t r = ::write(fd, p, left);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) throw std::runtime_error("Manifest write failed: " + path);
+        p += r;
+        left -= static_cast<size_t>(r);
+    }
+#else
+    (void)fd, (void)buf, (void)path;
+#endif
+}
+
+void sync_fd(int fd, const std::string& path) {
+#if defined(__APPLE__)
+    if (::fsync(fd) != 0) throw std::runtime_error("Manifest sync failed: " + path);
+#elif defined(__unix__)
+    if (::fdatasync(fd) != 0) throw std::runtime_error("Manifest sync failed: " + path);
+#else
+    (void)fd, (void)path;
+#endif
+}
+
+} // namespace
+
+void sync_dir(const std::string& dir) {
+#if defined(__unix__) || defined(__APPLE__)
+    int fd = ::open(dir.c_str(), O_RDONLY);
+    if (fd < 0) throw std::runtime_error("Failed to open directory: " + dir);
+    const int r = ::fsync(fd);
+    ::close(fd);
+    if (r != 0) throw std::runtime_error("Directory sync failed: " + dir);
+#else
+    (void)dir;
+#endif
+}
+
+Manifest::Manifest(const std::string& dir, int num_levels, uint64_t max_bytes)
+    : dir_(dir), num_levels_(num_levels), max_bytes_(max_bytes)
+{
+    namespace fs = std::filesystem;
+    levels_.resize(num_levels_);
+
+    const std::string legacy = dir_ + "/manifest.txt";
+    std::ifstream current(dir_ + "/CURRENT");
+    std::string name;
+    if (current && std::getline(current, name) && name.starts_with("MANIFEST-")) {
+        try {
+            manifest_number_ = std::stoull(name.substr(9));
+        } catch (...) {
+            throw std::runtime_error("Corrupt CURRENT file in " + dir_);
+        }
+        if (!replay_(dir_ + "/" + name)) throw std::runtime_error("Missing manifest: " + name);
+    } else if (fs::exists(legacy)) {
+        read_legacy_(legacy);
+    }
+
+    roll_();
+
+    // the old text manifest and logs of rolls that never became CURRENT
+    const std::string keep = manifest_name_(manifest_number_);
+    for (const auto& e : fs::directory_iterator(dir_)) {
+        const std::string f = e.path().filename().string();
+        if ((f.starts_with("MANIFEST-") && f != keep) || f == "manifest.txt" || f == "CURRENT.tmp") {
+            fs::remove(e.path());
+        }
+    }
+}
+
+Manifest::~Manifest() {
+#if defined(__unix__) || defined(__APPLE__)
+    if (fd_ >= 0) ::close(fd_);
+#endif
+}
+
+bool Manifest::contains(int level, const std::string& file) const {
+    if (level < 0 || level >= num_levels_) return false;
+    const auto& files = levels_[level];
+    return std::find(files.begin(), files.end(), file) != files.end();
+}
+
+void Manifest::log_and_apply(const ManifestEdit& edit) {
+    // After a failed append the log may end in a torn record, and replay
+    // stops there, so nothing more is appended to it: the next edit starts
+    // a new log instead.
+    if (failed_ || size_ >= max_bytes_) {
+        // the new log's snapshot already includes this edit; if it cannot
+        // be written, the edit is not applied
+        auto levels = levels_;
+        const uint64_t next_file_id = next_file_id_, log_number = log_number_;
+        apply_(edit);
+        try {
+            roll_();
+        } catch (...) {
+            levels_ = std::move(levels);
+            next_file_id_ = next_file_id;
+            log_number_ = log_number;
+            failed_ = true;
+            throw;
+        }
+        failed_ = false;
+        return;
+    }
+    try {
+        write_record_(edit);
+    } catch (...) {
+        failed_ = true;
+        throw;
+    }
+    apply_(edit);
+}
+
+void Manifest::apply_(const ManifestEdit& edit) {
+    auto check = [&](int level, const std::string& file) {
+        if (level < 0 || level >= num_levels_) {
+            throw std::runtime_error("Manifest level exceeds Options::num_levels: " + file);
+        }
+    };
+
+    std::optional<size_t> l0_pos;
+    for (const auto& [level, file] : edit.deleted) {
+        check(level, file);
+        auto& files = levels_[level];
+        auto it = std::find(files.begin(), files.end(), file);
+        if (it == files.end()) continue;
+        const size_t pos = it - files.begin();
+        if (level == 0) l0_pos = std::min(l0_pos.value_or(pos), pos);
+        files.erase(it);
+    }
+    size_t l0_insert = l0_pos.value_or(0);
+    for (const auto& [level, file] : edit.added) {
+        check(level, file);
+        auto& files = levels_[level];
+        if (level == 0) files.insert(files.begin() + l0_insert++, file);
+        else files.push_back(file);
+    }
+    if (edit.next_file_id) next_file_id_ = std::max(next_file_id_, *edit.next_file_id);
+    if (edit.log_number) log_number_ = std::max(log_number_, *edit.log_number);
+}
+
+bool Manifest::replay_(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) return false;
+    uint64_t left = std::filesystem::file_size(path);
+
+    // a torn or corrupt record ends the log: it was never acknowledged
+    while (true) {
+        uint32_t len = 0, crc = 0;
+        in.read(reinterpret_cast<char*>(&len), 4);
+        in.read(reinterpret_cast<char*>(&crc), 4);
+        if (!in || len > left - kHeaderSize) break;
+        left -= kHeaderSize + len;
+
+        std::string payload(len, '\0');
+        in.read(payload.data(), len);
+        if (!in || crc32c::value(payload.data(), len) != crc) break;
+
+        ManifestEdit edit;
+        if (!decode_(payload.data(), payload.size(), edit)) break;
+        apply_(edit);
+    }
+    return true;
+}
+
+void Manifest::read_legacy_(const std::string& path) {
+    // "<file> <level>" lines, L0 oldest first; a bare file name is L0
+    std::ifstream in(path);
+    ManifestEdit edit;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty()) continue;
+        std::istringstream ss(line);
+        std::string file;
+        int level = 0;
+        ss >> file;
+        if (!(ss >> level)) level = 0;
+        edit.added.emplace_back(level, std::move(file));
+    }
+    std::stable_partition(edit.added.begin(), edit.added.end(),
+                          [](const auto& a) { return a.first == 0; });
+    auto l0_end = std::find_if(edit.added.begin(), edit.added.end(),
+                               [](const auto& a) { return a.first != 0; });
+    std::reverse(edit.added.begin(), l0_end);
+    apply_(edit);
+}
+
+void Manifest::write_record_(const ManifestEdit& edit) {
+    std::string rec(kHeaderSize, '\0');
+    encode_(rec, edit);
+    const uint32_t len = static_cast<uint32_t>(rec.size() - kHeaderSize);
+    const uint32_t crc = crc32c::value(rec.data() + kHeaderSize, len);
+    std::memcpy(rec.data(), &len, 4);
+    std::memcpy(rec.data() + 4, &crc, 4);
+
+    const std::string path = dir_ + "/" + manifest_name_(manifest_number_);
+    write_all(fd_, rec, path);
+    sync_fd(fd_, path);
+    size_ += rec.size();
+}
+
+void Manifest::roll_() {
+    const uint64_t number = manifest_number_ + 1;
+    const std::string name = manifest_name_(number);
+    const std::string path = dir_ + "/" + name;
+
+    int fd = -1;
+#if defined(__unix__) || defined(__APPLE__)
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+#endif
+    if (fd < 0) throw std::runtime_error("Failed to open manifest: " + path);
+
+    ManifestEdit snapshot;
+    for (int level = 0; level < num_levels_; ++level) {
+        for (const auto& f : levels_[level]) snapshot.added.emplace_back(level, f);
+    }
+    snapshot.next_file_id = next_file_id_;
+    snapshot.log_number = log_number_;
+
+    const int old_fd = fd_;
+    const uint64_t old_number = manifest_number_;
+    fd_ = fd;
+    manifest_number_ = number;
+    size_ = 0;
+#if defined(__unix__) || defined(__APPLE__)
+    if (old_fd >= 0) ::close(old_fd);
+#endif
+    write_record_(snapshot);
+
+    // CURRENT only ever names a complete, durable log
+    const std::string tmp = dir_ + "/CURRENT.tmp";
+    int cfd = -1;
+#if defined(__unix__) || defined(__APPLE__)
+    cfd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+    if (cfd < 0) throw std::runtime_error("Failed to write CURRENT in " + dir_);
+    write_all(cfd, name + "\n", tmp);
+    sync_fd(cfd, tmp);
+#if defined(__unix__) || defined(__APPLE__)
+    ::close(cfd);
+#endif
+    std::filesystem::rename(tmp, dir_ + "/CURRENT");
+    sync_dir(dir_);
+
+    if (old_number > 0) std::filesystem::remove(dir_ + "/" + manifest_name_(old_number));
+}
+
+std::string Manifest::manifest_name_(uint64_t number) const {
+    std::ostringstream oss;
+    oss << "MANIFEST-" << std::setw(6) << std::setfill('0') << number;
+    return oss.str();
+}
+
+void Manifest::encode_(std::string& dst, const ManifestEdit& edit) {
+    auto put_file = [&](uint8_t tag, int level, const std::string& file) {
+        dst.push_back(static_cast<char>(tag));
+        put_u32(dst, static_cast<uint32_t>(level));
+        put_u32(dst, static_cast<uint32_t>(file.size()));
+        dst.append(file);
+    };
+    if (edit.next_file_id) {
+        dst.push_back(static_cast<char>(kNextFileId));
+        put_u64(dst, *edit.next_file_id);
+    }
+    if (edit.log_number) {
+        dst.push_back(static_cast<char>(kLogNumber));
+        put_u64(dst, *edit.log_number);
+    }
+    for (const auto& [level, file] : edit.deleted) put_file(kDeleted, level, file);
+    for (const auto& [level, file] : edit.added) put_file(kAdded, level, file);
+}
+
+bool Manifest::decode_(const char* p, size_t n, ManifestEdit& edit) {
+    const char* end = p + n;
+    while (p < end) {
+        const uint8_t tag = static_cast<uint8_t>(*p++);
+        if (tag == kNextFileId || tag == kLogNumber) {
+            uint64_t v = 0;
+            if (!get(p, end, v)) return false;
+            (tag == kNextFileId ? edit.next_file_id : edit.log_number) = v;
+        } else if (tag == kDeleted || tag == kAdded) {
+            uint32_t level = 0, len = 0;
+            if (!get(p, end, level) || !get(p, end, len)) return false;
+            if (static_cast<size_t>(end - p) < len) return false;
+            auto& files = tag == kDeleted ? edit.deleted : edit.added;
+            files.emplace_back(static_cast<int>(level), std::string(p, len));
+            p += len;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,189 @@
+#include "memtable.hpp"
+#include "key_hash.hpp"
+
+#include <limits>
+#include <new>
+#include <random>
+
+struct MemTable::Node {
+    std::string key;
+    std::optional<std::string> value;
+    uint64_t seq;
+    int height;
+
+    // height entries; storage is over-allocated by new_node()
+    std::atomic<Node*> next_[1];
+
+    Node* next(int level) const { return next_[level].load(std::memory_order_acquire); }
+};
+
+MemTable::Node* MemTable::new_node(int height, uint64_t seq, const std::string& key,
+                                   std::optional<std::string> value) {
+    const size_t bytes = sizeof(Node) + sizeof(std::atomic<Node*>) * (height - 1);
+    void* mem = ::operator new(bytes);
+    Node* n = new (mem) Node{key, std::move(value), seq, height, {}};
+    for (int i = 0; i < height; ++i) {
+        new (&n->next_[i]) std::atomic<Node*>(nullptr);
+    }
+    return n;
+}
+
+void MemTable::delete_node(Node* n) {
+    n->~Node();
+    ::operator delete(n);
+}
+
+MemTable::MemTable(PrefixExtractor prefix_extractor)
+    : head_(new_node(kMaxHeight, 0, std::string(), std::nullopt)),
+      prefix_extractor_(prefix_extractor)
+{
+    if (prefix_extractor_.enabled()) {
+        prefix_bloom_ = std::make_unique<std::atomic<uint64_t>[]>(kPrefixBloomBits / 64);
+    }
+}
+
+MemTable::~MemTable() {
+    Node* n = head_;
+    while (n) {
+        Node* nx = n->next_[0].load(std::memory_order_relaxed);
+        delete_node(n);
+        n = nx;
+    }
+}
+
+int MemTable::random_height() {
+    // branching factor 4, same as LevelDB
+    thread_local std::minstd_rand rng(std::random_device{}());
+    int h = 1;
+    while (h < kMaxHeight && (rng() & 3) == 0) ++h;
+    return h;
+}
+
+bool MemTable::node_less(const Node* a, const std::string& key, uint64_t seq) {
+    const int c = a->key.compare(key);
+    if (c != 0) return c < 0;
+    return a->seq > seq; // newer first
+}
+
+const MemTable::Node* MemTable::find_greater_or_equal(const std::string& key,
+                                                      uint64_t seq) const {
+    const Node* x = head_;
+    int level = max_height_.load(std::memory_order_relaxed) - 1;
+    while (true) {
+        const Node* nx = x->next(level);
+        if (nx && node_less(nx, key, seq)) {
+            x = nx;
+        } else if (level == 0) {
+            return nx;
+        } else {
+            --level;
+        }
+    }
+}
+
+void MemTable::find_splice_for_level(const Node* x, Node* before, int level,
+                                     Node** out_prev, Node** out_next) const {
+    while (true) {
+        Node* nx = before->next(level);
+        if (!nx || !node_less(nx, x->key, x->seq)) {
+            *out_prev = before;
+            *out_next = nx;
+            return;
+        }
+        before = nx;
+    }
+}
+
+void MemTable::add(uint64_t seq, const std::string& key, std::optional<std::string> value) {
+    const size_t charge = key.size() + (value ? value->size() : 0) + 16;
+    const int height = random_height();
+    Node* x = new_node(height, seq, key, std::move(value));
+
+    // before the node is linked, so a reader that can see it sees these
+    if (prefix_bloom_) {
+        if (auto p = prefix_extractor_.prefix(key)) {
+            uint64_t h = key_hash::value(*p);
+            const uint64_t delta = (h >> 32) | 1;
+            for (int i = 0; i < kPrefixBloomProbes; ++i, h += delta) {
+                const size_t bit = h % kPrefixBloomBits;
+                prefix_bloom_[bit / 64].fetch_or(1ULL << (bit % 64), std::memory_order_relaxed);
+            }
+        }
+    }
+
+    int cur = max_height_.load(std::memory_order_relaxed);
+    while (height > cur &&
+           !max_height_.compare_exchange_weak(cur, height, std::memory_order_relaxed)) {
+    }
+
+    Node* prev[kMaxHeight];
+    Node* next[kMaxHeight];
+    Node* before = head_;
+    for (int i = kMaxHeight - 1; i >= 0; --i) {
+        find_splice_for_level(x, before, i, &prev[i], &next[i]);
+        before = prev[i];
+    }
+
+    // Link bottom-up so a node is reachable at level 0 before any index level.
+    // Nodes are never removed, so a failed CAS only means someone inserted
+    // between prev and next; resume the search from prev.
+    for (int i = 0; i < height; ++i) {
+        while (true) {
+            x->next_[i].store(next[i], std::memory_order_relaxed);
+            if (prev[i]->next_[i].compare_exchange_strong(next[i], x,
+                                                          std::memory_order_release,
+                                                          std::memory_order_acquire)) {
+                break;
+            }
+            find_splice_for_level(x, prev[i], i, &prev[i], &next[i]);
+        }
+    }
+
+    bytes_.fetch_add(charge, std::memory_order_relaxed);
+    entries_.fetch_add(1, std::memory_order_relaxed);
+}
+
+std::optional<std::optional<std::string>> MemTable::get(const std::string& key) const {
+    const Node* n = find_greater_or_equal(key, std::numeric_limits<uint64_t>::max());
+    if (n && n->key == key) return n->value;
+    return std::nullopt;
+}
+
+bool MemTable::empty() const {
+    return head_->next(0) == nullptr;
+}
+
+bool MemTable::may_contain_prefix(uint64_t hash) const {
+    if (!prefix_bloom_) return true;
+    uint64_t h = hash;
+    const uint64_t delta = (h >> 32) | 1;
+    for (int i = 0; i < kPrefixBloomProbes; ++i, h += delta) {
+        const size_t bit = h % kPrefixBloomBits;
+        if ((prefix_bloom_[bit / 64].load(std::memory_order_relaxed) & (1ULL << (bit % 64))) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+MemTable::Iterator::Iterator(const MemTable& mem)
+    : mem_(mem), node_(mem.head_->next(0)) {}
+
+void MemTable::Iterator::seek(const std::string& target) {
+    node_ = mem_.find_greater_or_equal(target, std::numeric_limits<uint64_t>::max());
+}
+
+void MemTable::Iterator::next() {
+    const std::string& cur = node_->key;
+    do {
+        node_ = node_->next(0);
+    } while (node_ && node_->key == cur);
+}
+
+const std::string& MemTable::Iterator::key() const {
+    return node_->key;
+}
+
+const std::optional<std::string>& MemTable::Iterator::value() const {
+    return node_->value;
+}
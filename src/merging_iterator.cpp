@@ -0,0 +1,51 @@
+#include "merging_iterator.hpp"
+
+#include <algorithm>
+
+MergingIterator::MergingIterator(std::vector<std::unique_ptr<KVIterator>> children)
+    : children_(std::move(children))
+{
+    rebuild_heap();
+}
+
+void MergingIterator::rebuild_heap() {
+    heap_.clear();
+    for (size_t i = 0; i < children_.size(); ++i) {
+        if (children_[i]->valid()) heap_.push_back(i);
+    }
+    std::make_heap(heap_.begin(), heap_.end(), [this](size_t a, size_t b) { return after(a, b); });
+}
+
+void MergingIterator::seek(const std::string& target) {
+    for (auto& c : children_) c->seek(target);
+    rebuild_heap();
+}
+
+bool MergingIterator::after(size_t a, size_t b) const {
+    const int c = children_[a]->key().compare(children_[b]->key());
+    if (c != 0) return c > 0;
+    return a > b; // newer child first
+}
+
+void MergingIterator::next() {
+    auto cmp = [this](size_t a, size_t b) { return after(a, b); };
+
+    // advance every child positioned on the current key
+    cur_ = key();
+    while (!heap_.empty() && children_[heap_.front()]->key() == cur_) {
+        std::pop_heap(heap_.begin(), heap_.end(), cmp);
+        const size_t i = heap_.back();
+        heap_.pop_back();
+
+        children_[i]->next();
+        if (children_[i]->valid()) {
+            heap_.push_back(i);
+            std::push_heap(heap_.begin(), heap_.end(), cmp);
+        }
+    }
+}
+
+bool MergingIterator::corrupted() const {
+    return std::any_of(children_.begin(), children_.end(),
+                       [](const auto& c) { return c->corrupted(); });
+}
@@ -0,0 +1,95 @@
+#include "rate_limiter.hpp"
+
+#include <algorithm>
+
+// auto-tune: back off at kSlowFactor times the baseline latency, recover
+// below kFastFactor; never below max/kMinRateDivisor
+static constexpr double kSlowFactor = 2.0;
+static constexpr double kFastFactor = 1.5;
+static constexpr double kBackoff = 0.8;
+static constexpr double kRecover = 1.1;
+static constexpr uint64_t kMinRateDivisor = 20;
+
+RateLimiter::RateLimiter(uint64_t bytes_per_second, bool auto_tune)
+    : auto_tune_(auto_tune),
+      rate_(bytes_per_second),
+      max_rate_(bytes_per_second),
+      last_refill_(Clock::now()),
+      last_tune_(last_refill_) {}
+
+void RateLimiter::set_bytes_per_second(uint64_t bytes_per_second) {
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        refill_(Clock::now());
+        max_rate_ = bytes_per_second;
+        rate_ = bytes_per_second;
+    }
+    cv_.notify_all();
+}
+
+void RateLimiter::record_read_latency(uint64_t micros) {
+    if (!auto_tune_) return;
+    latency_sum_.fetch_add(micros, std::memory_order_relaxed);
+    latency_count_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void RateLimiter::refill_(Clock::time_point now) {
+    const double rate = static_cast<double>(rate_.load());
+    const double elapsed = std::chrono::duration<double>(now - last_refill_).count();
+    const double burst = rate * std::chrono::duration<double>(kRefillPeriod).count();
+    available_ = std::min(available_ + elapsed * rate, burst);
+    last_refill_ = now;
+}
+
+void RateLimiter::tune_(Clock::time_point now) {
+    if (!auto_tune_ || now - last_tune_ < kTunePeriod) return;
+    last_tune_ = now;
+
+    const uint64_t count = latency_count_.exchange(0);
+    const uint64_t sum = latency_sum_.exchange(0);
+    const uint64_t max_rate = max_rate_.load();
+    const uint64_t rate = rate_.load();
+    if (max_rate == 0) return;
+
+    // no foreground reads to protect: head back to the ceiling
+    double next = rate * kRecover;
+    if (count > 0) {
+        const double avg = static_cast<double>(sum) / count;
+        if (baseline_micros_ == 0) baseline_micros_ = avg;
+        if (avg > baseline_micros_ * kSlowFactor) {
+            next = rate * kBackoff;
+        } else {
+            // only unslowed periods move the baseline, so a long stretch
+            // of slow reads does not become the new normal
+            baseline_micros_ = 0.9 * baseline_micros_ + 0.1 * avg;
+            if (avg > baseline_micros_ * kFastFactor) next = rate;
+        }
+    }
+    refill_(now);
+    rate_ = std::clamp(static_cast<uint64_t>(next), std::max<uint64_t>(max_rate / kMinRateDivisor, 1),
+                       max_rate);
+}
+
+void RateLimiter::request(size_t bytes, Priority pri) {
+    if (rate_.load(std::memory_order_relaxed) == 0) return;
+
+    std::unique_lock<std::mutex> lk(mu_);
+    while (true) {
+        const auto now = Clock::now();
+        tune_(now);
+        refill_(now);
+        const double rate = static_cast<double>(rate_.load());
+        if (rate == 0) return;
+
+        // A request larger than a burst goes through once the bucket is
+        // full and leaves it in debt, which later requests wait out.
+        const double burst = rate * std::chrono::duration<double>(kRefillPeriod).count();
+        if (pri == Priority::kHigh || available_ >= std::min(static_cast<double>(bytes), burst)) {
+            available_ -= static_cast<double>(bytes);
+            return;
+        }
+        const double wait = (std::min(static_cast<double>(bytes), burst) - available_) / rate;
+        cv_.wait_for(lk, std::min(std::chrono::duration<double>(wait),
+                                  std::chrono::duration<double>(kRefillPeriod)));
+    }
+}
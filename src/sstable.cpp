@@ -1,10 +1,17 @@
 #include "sstable.hpp"
+#include "cache.hpp"
+#include "crc32c.hpp"
+#include "key_hash.hpp"
+#include "manifest.hpp"
 
 #include <fstream>
 #include <filesystem>
+#include <chrono>
+#include <cmath>
 #include <algorithm>
 #include <limits>
 #include <vector>
+#include <cstddef>
 #include <cstring>
 #include <stdexcept>
 
@@ -15,16 +22,57 @@
 
 using namespace std;
 
-static constexpr uint64_t FOOTER_MAGIC = 0x48454C494F535354ULL; // "HELIOSST"
+static constexpr uint64_t FOOTER_MAGIC = 0x48454C494F534254ULL; // "HELIOSBT"
+static constexpr uint32_t FORMAT_VERSION = 3;
+
 #pragma pack(push, 1)
-struct Footer {
+// Last bytes of every block-format table; the version says which footer
+// precedes it.
+struct FooterTail {
+    uint32_t version;
+    uint32_t checksum; // v1/v2: FNV-1a over everything before the footer
+                       // v3: CRC32C over the footer up to this field
+    uint64_t magic;
+};
+
+struct FooterV1 {
+    uint64_t index_offset;
+    uint64_t index_size;
+    FooterTail tail;
+};
+
+// v2 and v3. The filter, properties and index blocks are contiguous, in
+// that order, and end where the footer starts. v3 also puts a CRC32C
+// trailer after every data block (not counted in its index handle).
+struct FooterV2 {
+    uint64_t filter_offset;
+    uint64_t filter_size;
+    uint64_t props_offset;
+    uint64_t props_size;
+    uint64_t index_offset;
+    uint64_t index_size;
+    uint32_t meta_checksum; // over filter..index; v2: FNV-1a, v3: CRC32C
+    FooterTail tail;
+};
+
+// Pre-block format: [ksize u32][vsize u32][key][value]* then this footer
+static constexpr uint64_t LEGACY_FOOTER_MAGIC = 0x48454C494F535354ULL; // "HELIOSST"
+struct LegacyFooter {
     uint64_t magic;
     uint32_t checksum; // FNV-1a over records region
 };
 #pragma pack(pop)
 
-uint32_t SSTable::fnv1a_32(const uint8_t* data, size_t n) {
-    uint32_t h = 2166136261u;
+static uint64_t footer_size(uint32_t version) {
+    switch (version) {
+    case 1: return sizeof(FooterV1);
+    case 2:
+    case 3: return sizeof(FooterV2);
+    default: return 0;
+    }
+}
+
+uint32_t SSTable::fnv1a_32(const uint8_t* data, size_t n, uint32_t h) {
     for (size_t i = 0; i < n; ++i) {
         h ^= data[i];
         h *= 16777619u;
@@ -35,98 +83,191 @@ uint32_t SSTable::fnv1a_32(const uint8_t* data, size_t n) {
 static void fsync_file(const std::string& path) {
 #if defined(__unix__) || defined(__APPLE__)
     int fd = ::open(path.c_str(), O_RDONLY);
-    if (fd >= 0) {
-        ::fsync(fd);
-        ::close(fd);
-    }
+    if (fd < 0) throw std::runtime_error("Failed to open SSTable: " + path);
+    const int r = ::fsync(fd);
+    ::close(fd);
+    if (r != 0) throw std::runtime_error("SSTable sync failed: " + path);
 #else
     (void)path;
 #endif
 }
 
+static constexpr size_t kBlockTrailerSize = 4;
+
+static uint32_t footer_crc(const FooterV2& f) {
+    return crc32c::value(&f, offsetof(FooterV2, tail) + sizeof(f.tail.version));
+}
+
 bool SSTable::is_valid(const std::string& path) {
+    {
+        // v3 carries per-block checksums: verify them block by block
+        SSTable t(path);
+        if (t.valid() && t.version_ >= 3) return t.verify_blocks();
+    }
+
     std::error_code ec;
     auto sz = std::filesystem::file_size(path, ec);
-    if (ec || sz < sizeof(Footer)) return false;
+    if (ec || sz < sizeof(FooterTail)) return false;
 
     std::ifstream in(path, std::ios::binary);
     if (!in.is_open()) return false;
 
-    in.seekg(static_cast<std::streamoff>(sz - sizeof(Footer)), std::ios::beg);
-    Footer f{};
-    in.read(reinterpret_cast<char*>(&f), sizeof(f));
+    in.seekg(static_cast<std::streamoff>(sz - sizeof(FooterTail)), std::ios::beg);
+    FooterTail t{};
+    in.read(reinterpret_cast<char*>(&t), sizeof(t));
     if (!in) return false;
-    if (f.magic != FOOTER_MAGIC) return false;
+    if (t.magic != FOOTER_MAGIC) return false;
 
-    const uint64_t records_len = static_cast<uint64_t>(sz - sizeof(Footer));
+    const uint64_t fsize = footer_size(t.version);
+    if (fsize == 0 || sz < fsize) return false;
+
+    const uint64_t body_len = static_cast<uint64_t>(sz - fsize);
     in.seekg(0, std::ios::beg);
 
-    std::vector<uint8_t> buf(records_len);
-    in.read(reinterpret_cast<char*>(buf.data()), records_len);
+    std::vector<uint8_t> buf(body_len);
+    in.read(reinterpret_cast<char*>(buf.data()), body_len);
     if (!in) return false;
 
     uint32_t chk = fnv1a_32(buf.data(), buf.size());
-    return chk == f.checksum;
+    return chk == t.checksum;
 }
 
 std::string SSTable::bloom_path_for(const std::string& sstable_path) {
     return sstable_path + ".bloom";
 }
 
-SSTable::SSTable(const std::string& path)
-    : path_(path)
+SSTable::SSTable(const std::string& path, BlockCache* cache, uint64_t file_id,
+                 RateLimiter* rate_limiter)
+    : path_(path), cache_(cache), file_id_(file_id), rate_limiter_(rate_limiter)
 {
-    valid_ = SSTable::is_valid(path_);
-    if (!valid_) return;
-
+    // Only the footer and meta blocks are read here; the body checksum is
+    // checked separately by is_valid().
 #if defined(__unix__) || defined(__APPLE__)
     fd_ = ::open(path_.c_str(), O_RDONLY);
-    if (fd_ < 0) { valid_ = false; return; }
+    if (fd_ < 0) return;
 #else
-    valid_ = false;
     return;
 #endif
 
-    auto total = std::filesystem::file_size(path_);
-    end_ = static_cast<uint64_t>(total - sizeof(Footer));
+    std::error_code ec;
+    const uint64_t total = std::filesystem::file_size(path_, ec);
+    if (ec || total < sizeof(FooterTail)) return;
+    file_size_ = total;
 
-    // Load bloom sidecar if exists
-    bool ok = false;
-    bloom_ = BloomFilter::load(bloom_path_for(path_), ok);
-    bloom_ok_ = ok;
+    FooterTail t{};
+    if (!pread_all(&t, sizeof(t), total - sizeof(t))) return;
+    if (t.magic != FOOTER_MAGIC || total < footer_size(t.version)) return;
 
-    // Build sparse index via single scan using pread
-    uint64_t offset = 0;
-    uint32_t count = 0;
+    version_ = t.version;
+    if (version_ == 1) valid_ = open_v1(total);
+    else if (version_ == 2 || version_ == 3) valid_ = open_v2(total);
+}
 
-    while (offset < end_) {
-        uint32_t ksize = 0, vsize = 0;
-        if (!pread_all(&ksize, 4, offset)) break;
-        if (!pread_all(&vsize, 4, offset + 4)) break;
+bool SSTable::open_v1(uint64_t file_size) {
+    FooterV1 f{};
+    if (!pread_all(&f, sizeof(f), file_size - sizeof(f))) return false;
 
-        if (offset + 8ULL + ksize > end_) break;
+    const uint64_t body_len = file_size - sizeof(f);
+    if (f.index_offset > body_len || f.index_size > body_len - f.index_offset) return false;
 
-        std::string key(ksize, '\0');
-        if (ksize && !pread_all(key.data(), ksize, offset + 8)) break;
+    std::string buf(f.index_size, '\0');
+    if (!pread_all(buf.data(), buf.size(), f.index_offset)) return false;
+    if (!parse_index(buf.data(), buf.size(), f.index_offset)) return false;
 
-        uint64_t next = offset + 8ULL + ksize;
-        if (vsize != TOMBSTONE_VSIZE) {
-            if (next + vsize > end_) break;
-            next += vsize;
-        }
+    bool ok = false;
+    bloom_ = BloomFilter::load(bloom_path_for(path_), ok);
+    filter_ok_ = ok;
+
+    // no properties block: bounds come from the first block and the index
+    if (!index_.empty()) {
+        std::string_view k;
+        std::optional<std::string_view> v;
+        auto first = load_block(index_.front());
+        if (!first || !first->entry(0, k, v)) return false;
+        smallest_.assign(k);
+        largest_ = index_.back().key;
+    }
+    return true;
+}
 
-        if (count % kIndexStride == 0) {
-            index_.push_back({key, offset});
-        }
-        count++;
-        offset = next;
+bool SSTable::open_v2(uint64_t file_size) {
+    FooterV2 f{};
+    if (!pread_all(&f, sizeof(f), file_size - sizeof(f))) return false;
+    if (version_ >= 3 && footer_crc(f) != f.tail.checksum) return false;
+
+    // meta blocks are contiguous: one read, one checksum
+    const uint64_t meta_end = file_size - sizeof(f);
+    if (f.filter_offset > meta_end) return false;
+    if (f.props_offset != f.filter_offset + f.filter_size) return false;
+    if (f.index_offset != f.props_offset + f.props_size) return false;
+    if (f.index_offset + f.index_size != meta_end) return false;
+
+    std::string meta(meta_end - f.filter_offset, '\0');
+    if (!pread_all(meta.data(), meta.size(), f.filter_offset)) return false;
+    const uint32_t meta_chk = version_ >= 3
+        ? crc32c::value(meta.data(), meta.size())
+        : fnv1a_32(reinterpret_cast<const uint8_t*>(meta.data()), meta.size());
+    if (meta_chk != f.meta_checksum) return false;
+
+    const char* p = meta.data();
+    bool ok = false;
+    const std::string filter(p, f.filter_size);
+    if (BinaryFuseFilter::is_encoded(filter)) {
+        filter_type_ = FilterType::kBinaryFuse;
+        fuse_ = BinaryFuseFilter::decode(filter, ok);
+    } else {
+        bloom_ = BloomFilter::decode(filter, ok);
+    }
+    filter_ok_ = ok;
+    p += f.filter_size;
+
+    if (!parse_properties(p, f.props_size)) return false;
+    p += f.props_size;
+
+    return parse_index(p, f.index_size, f.filter_offset);
+}
+
+bool SSTable::parse_properties(const char* p, uint64_t size) {
+    // [num_entries u64][num_deletions u64][ksize u32][smallest][ksize u32][largest]
+    // [prefix filter section]?
+    if (size < 24) return false;
+    std::memcpy(&num_entries_, p, 8);
+    std::memcpy(&num_deletions_, p + 8, 8);
+
+    uint64_t pos = 16;
+    for (std::string* out : {&smallest_, &largest_}) {
+        uint32_t ksize = 0;
+        if (pos + 4 > size) return false;
+        std::memcpy(&ksize, p + pos, 4);
+        pos += 4;
+        if (pos + ksize > size) return false;
+        out->assign(p + pos, ksize);
+        pos += ksize;
     }
+    if (pos == size) return true;
+
+    // [nsize u32][prefix extractor name][prefix BloomFilter]
+    uint32_t nsize = 0;
+    if (pos + 4 > size) return false;
+    std::memcpy(&nsize, p + pos, 4);
+    pos += 4;
+    if (nsize == 0 || pos + nsize > size) return false;
+    prefix_extractor_name_.assign(p + pos, nsize);
+    pos += nsize;
+    bool ok = false;
+    prefix_bloom_ = BloomFilter::decode(std::string(p + pos, size - pos), ok);
+    return ok;
 }
 
 SSTable::~SSTable() {
 #if defined(__unix__) || defined(__APPLE__)
     if (fd_ >= 0) ::close(fd_);
 #endif
+    if (obsolete_.load(std::memory_order_relaxed)) {
+        std::error_code ec;
+        std::filesystem::remove(path_, ec);
+        std::filesystem::remove(bloom_path_for(path_), ec);
+    }
 }
 
 bool SSTable::pread_all(void* buf, size_t n, uint64_t off) const {
@@ -145,124 +286,386 @@ bool SSTable::pread_all(void* buf, size_t n, uint64_t off) const {
 #endif
 }
 
-bool SSTable::read_record_at(
-    uint64_t offset,
-    std::string& out_key,
-    std::optional<std::string>& out_value,
-    uint64_t& out_next_offset
-) const {
-    if (!valid_) return false;
-    if (offset >= end_) return false;
-
-    uint32_t ksize = 0, vsize = 0;
-    if (!pread_all(&ksize, 4, offset)) return false;
-    if (!pread_all(&vsize, 4, offset + 4)) return false;
+bool SSTable::parse_index(const char* p, uint64_t size, uint64_t data_end) {
+    // [ksize u32][key][offset u64][size u32]* then [count u32]
+    if (size < 4) return false;
+
+    uint32_t n = 0;
+    std::memcpy(&n, p + size - 4, 4);
+    const uint64_t end = size - 4;
+
+    uint64_t pos = 0;
+    index_.reserve(n);
+    for (uint32_t i = 0; i < n; ++i) {
+        uint32_t ksize = 0;
+        if (pos + 4 > end) return false;
+        std::memcpy(&ksize, p + pos, 4);
+        pos += 4;
+        if (pos + ksize + 12 > end) return false;
+
+        IndexEntry e;
+        e.key.assign(p + pos, ksize);
+        pos += ksize;
+        std::memcpy(&e.offset, p + pos, 8);
+        std::memcpy(&e.size, p + pos + 8, 4);
+        pos += 12;
+        if (e.offset > data_end || e.size > data_end - e.offset) return false;
+        index_.push_back(std::move(e));
+    }
+    return pos == end;
+}
 
-    if (offset + 8ULL + ksize > end_) return false;
+std::shared_ptr<const Block> SSTable::read_block(const IndexEntry& e, bool fill_cache) const {
+    if (cache_) {
+        if (auto b = cache_->lookup(file_id_, e.offset)) return b;
+    }
+    // fill_cache is false for background scans
+    if (rate_limiter_ && !fill_cache) {
+        rate_limiter_->request(e.size, RateLimiter::Priority::kLow);
+    }
+    std::shared_ptr<const Block> b;
+    if (rate_limiter_ && fill_cache) {
+        const auto start = std::chrono::steady_clock::now();
+        b = load_block(e);
+        rate_limiter_->record_read_latency(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count());
+    } else {
+        b = load_block(e);
+    }
+    if (b && cache_ && fill_cache) {
+        cache_->insert(file_id_, e.offset, b, sizeof(Block) + e.size);
+    }
+    return b;
+}
 
-    out_key.assign(ksize, '\0');
-    if (ksize && !pread_all(out_key.data(), ksize, offset + 8)) return false;
+std::shared_ptr<const Block> SSTable::load_block(const IndexEntry& e) const {
+    const size_t trailer = version_ >= 3 ? kBlockTrailerSize : 0;
+    std::string buf(e.size + trailer, '\0');
+    if (!pread_all(buf.data(), buf.size(), e.offset)) {
+        corrupted_.store(true, std::memory_order_relaxed);
+        return nullptr;
+    }
 
-    uint64_t pos = offset + 8ULL + ksize;
-    if (vsize == TOMBSTONE_VSIZE) {
-        out_value = std::nullopt;
-        out_next_offset = pos;
-        return true;
+    if (trailer) {
+        uint32_t stored = 0;
+        std::memcpy(&stored, buf.data() + e.size, 4);
+        if (crc32c::value(buf.data(), e.size) != stored) {
+            corrupted_.store(true, std::memory_order_relaxed);
+            return nullptr;
+        }
+        buf.resize(e.size);
     }
 
-    if (pos + vsize > end_) return false;
+    auto b = std::make_shared<const Block>(std::move(buf));
+    if (!b->ok()) {
+        corrupted_.store(true, std::memory_order_relaxed);
+        return nullptr;
+    }
+    return b;
+}
 
-    std::string val(vsize, '\0');
-    if (vsize && !pread_all(val.data(), vsize, pos)) return false;
-    out_value = std::move(val);
-    out_next_offset = pos + vsize;
+bool SSTable::verify_blocks() const {
+    // bypasses the cache: the point is to re-read what is on disk
+    for (const auto& e : index_) {
+        if (!load_block(e)) return false;
+    }
     return true;
 }
 
+SSTable::Builder::Builder(const std::string& final_path, uint64_t expected_entries,
+                          FilterType filter_type, double bits_per_key, RateLimiter* rate_limiter,
+                          RateLimiter::Priority priority, PrefixExtractor prefix_extractor)
+    : final_path_(final_path),
+      tmp_path_(final_path + ".tmp"),
+      out_(tmp_path_, std::ios::binary | std::ios::trunc),
+      rate_limiter_(rate_limiter),
+      priority_(priority),
+      filter_type_(filter_type),
+      prefix_extractor_(prefix_extractor)
+{
+    if (filter_type_ == FilterType::kBloom && bits_per_key > 0) {
+        // k = bits * ln 2 minimizes the false positive rate (7 at 10 bits/key)
+        const double bits = std::min(static_cast<double>(expected_entries) * bits_per_key, 4e9);
+        const uint32_t k = std::clamp(static_cast<uint32_t>(std::lround(bits_per_key * 0.693)), 1u, 30u);
+        bloom_ = BloomFilter(expected_entries ? static_cast<uint32_t>(bits) : 8u, k);
+    }
+    if (!out_.is_open()) throw std::runtime_error("Failed to open SSTable tmp");
+}
+
+SSTable::Builder::~Builder() {
+    if (finished_) return;
+    out_.close();
+    std::error_code ec;
+    std::filesystem::remove(tmp_path_, ec);
+}
+
+void SSTable::Builder::emit(const void* p, size_t n) {
+    if (rate_limiter_) rate_limiter_->request(n, priority_);
+    out_.write(reinterpret_cast<const char*>(p), static_cast<std::streamsize>(n));
+    offset_ += n;
+}
+
+void SSTable::Builder::flush_block() {
+    if (block_.empty()) return;
+    const std::string contents = block_.finish();
+    const uint64_t block_off = offset_;
+    const uint32_t crc = crc32c::value(contents.data(), contents.size());
+    emit(contents.data(), contents.size());
+    emit(&crc, kBlockTrailerSize);
+
+    const uint32_t ksize = static_cast<uint32_t>(last_key_.size());
+    const uint32_t bsize = static_cast<uint32_t>(contents.size());
+    index_.append(reinterpret_cast<const char*>(&ksize), 4);
+    index_.append(last_key_);
+    index_.append(reinterpret_cast<const char*>(&block_off), 8);
+    index_.append(reinterpret_cast<const char*>(&bsize), 4);
+    num_blocks_++;
+}
+
+void SSTable::Builder::add(const std::string& key, const std::optional<std::string>& value) {
+    if (num_entries_ == 0) smallest_ = key;
+    block_.add(key, value);
+    if (filter_type_ == FilterType::kBinaryFuse) key_hashes_.push_back(key_hash::value(key));
+    else bloom_.add(key);
+    // keys sharing a prefix are adjacent
+    if (auto p = prefix_extractor_.prefix(key); p && (prefix_hashes_.empty() || *p != last_prefix_)) {
+        prefix_hashes_.push_back(key_hash::value(*p));
+        last_prefix_.assign(*p);
+    }
+    num_entries_++;
+    if (!value) num_deletions_++;
+    last_key_ = key;
+    if (block_.size_estimate() >= kBlockSize) flush_block();
+}
+
+void SSTable::Builder::finish() {
+    flush_block();
+
+    index_.append(reinterpret_cast<const char*>(&num_blocks_), 4);
+
+    std::string props;
+    props.append(reinterpret_cast<const char*>(&num_entries_), 8);
+    props.append(reinterpret_cast<const char*>(&num_deletions_), 8);
+    for (const std::string* k : {&smallest_, &last_key_}) {
+        const uint32_t ksize = static_cast<uint32_t>(k->size());
+        props.append(reinterpret_cast<const char*>(&ksize), 4);
+        props.append(*k);
+    }
+    if (prefix_extractor_.enabled()) {
+        BloomFilter prefixes(std::max<uint32_t>(static_cast<uint32_t>(prefix_hashes_.size()) * 10, 8), 7);
+        for (uint64_t h : prefix_hashes_) prefixes.add_hash(h);
+        const std::string name = prefix_extractor_.name();
+        const uint32_t nsize = static_cast<uint32_t>(name.size());
+        props.append(reinterpret_cast<const char*>(&nsize), 4);
+        props.append(name);
+        props.append(prefixes.encode());
+    }
+
+    std::string filter;
+    if (filter_type_ == FilterType::kBinaryFuse) {
+        // an empty bloom filter (every key a maybe) if no seed works
+        BinaryFuseFilter fuse;
+        filter = fuse.build(std::move(key_hashes_)) ? fuse.encode() : BloomFilter().encode();
+    } else {
+        filter = bloom_.encode();
+    }
+
+    // filter, properties and index back to back, covered by meta_checksum
+    FooterV2 f{};
+    f.filter_offset = offset_;
+    f.filter_size = filter.size();
+    f.props_offset = f.filter_offset + f.filter_size;
+    f.props_size = props.size();
+    f.index_offset = f.props_offset + f.props_size;
+    f.index_size = index_.size();
+
+    emit(filter.data(), filter.size());
+    emit(props.data(), props.size());
+    emit(index_.data(), index_.size());
+
+    uint32_t meta_chk = crc32c::value(filter.data(), filter.size());
+    meta_chk = crc32c::extend(meta_chk, props.data(), props.size());
+    meta_chk = crc32c::extend(meta_chk, index_.data(), index_.size());
+    f.meta_checksum = meta_chk;
+    f.tail.version = FORMAT_VERSION;
+    f.tail.magic = FOOTER_MAGIC;
+    f.tail.checksum = footer_crc(f);
+
+    emit(&f, sizeof(f));
+    out_.flush();
+    out_.close();
+    if (!out_) throw std::runtime_error("Failed to write SSTable");
+
+    // The manifest edit that names this table is logged after finish()
+    // returns, and the WAL it replaces is deleted after that, so the rename
+    // must be durable first.
+    fsync_file(tmp_path_);
+    std::filesystem::rename(tmp_path_, final_path_);
+    finished_ = true;
+    const std::string dir = std::filesystem::path(final_path_).parent_path().string();
+    sync_dir(dir.empty() ? "." : dir);
+}
+
 void SSTable::write_atomic(
     const std::string& final_path,
     const std::vector<std::pair<std::string, std::optional<std::string>>>& entries
 ) {
-    const std::string tmp = final_path + ".tmp";
-
-    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
-    if (!out.is_open()) throw std::runtime_error("Failed to open SSTable tmp");
-
-    uint32_t chk = 2166136261u;
-    auto fnv_feed = [&](const void* p, size_t n) {
-        const uint8_t* b = reinterpret_cast<const uint8_t*>(p);
-        for (size_t i = 0; i < n; ++i) { chk ^= b[i]; chk *= 16777619u; }
-    };
-
-    // Build bloom for this table (tunable):
-    // 10 bits/key, 7 hashes is a common-ish baseline.
-    const uint32_t m_bits = static_cast<uint32_t>(entries.size() * 10ULL);
-    const uint32_t k_hash = 7;
-    BloomFilter bloom(m_bits ? m_bits : 8u, k_hash);
+    Builder b(final_path, entries.size());
+    for (const auto& [k, v] : entries) b.add(k, v);
+    b.finish();
+}
 
-    for (const auto& [k, v] : entries) {
-        uint32_t ksize = static_cast<uint32_t>(k.size());
-        uint32_t vsize = v ? static_cast<uint32_t>(v->size()) : TOMBSTONE_VSIZE;
+bool SSTable::upgrade_legacy(const std::string& path) {
+    std::error_code ec;
+    auto sz = std::filesystem::file_size(path, ec);
+    if (ec || sz < sizeof(LegacyFooter)) return false;
 
-        out.write(reinterpret_cast<const char*>(&ksize), 4);
-        out.write(reinterpret_cast<const char*>(&vsize), 4);
-        out.write(k.data(), ksize);
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) return false;
 
-        fnv_feed(&ksize, 4);
-        fnv_feed(&vsize, 4);
-        fnv_feed(k.data(), ksize);
+    in.seekg(static_cast<std::streamoff>(sz - sizeof(LegacyFooter)), std::ios::beg);
+    LegacyFooter f{};
+    in.read(reinterpret_cast<char*>(&f), sizeof(f));
+    if (!in || f.magic != LEGACY_FOOTER_MAGIC) return false;
 
-        bloom.add(k);
+    const uint64_t end = static_cast<uint64_t>(sz - sizeof(LegacyFooter));
+    std::vector<uint8_t> buf(end);
+    in.seekg(0, std::ios::beg);
+    in.read(reinterpret_cast<char*>(buf.data()), end);
+    if (!in || fnv1a_32(buf.data(), buf.size()) != f.checksum) return false;
 
-        if (vsize != TOMBSTONE_VSIZE) {
-            out.write(v->data(), v->size());
-            fnv_feed(v->data(), v->size());
+    std::vector<std::pair<std::string, std::optional<std::string>>> entries;
+    uint64_t off = 0;
+    while (off + 8 <= end) {
+        uint32_t ksize = 0, vsize = 0;
+        std::memcpy(&ksize, buf.data() + off, 4);
+        std::memcpy(&vsize, buf.data() + off + 4, 4);
+        off += 8;
+        if (off + ksize > end) return false;
+
+        std::string key(reinterpret_cast<const char*>(buf.data() + off), ksize);
+        off += ksize;
+        if (vsize == kTombstoneVSize) {
+            entries.push_back({std::move(key), std::nullopt});
+            continue;
         }
+        if (off + vsize > end) return false;
+        entries.push_back({std::move(key),
+                           std::string(reinterpret_cast<const char*>(buf.data() + off), vsize)});
+        off += vsize;
     }
+    if (off != end) return false;
+
+    write_atomic(path, entries);
+    std::filesystem::remove(bloom_path_for(path)); // filter is in the table now
+    return true;
+}
 
-    Footer f{FOOTER_MAGIC, chk};
-    out.write(reinterpret_cast<const char*>(&f), sizeof(f));
-    out.flush();
-    out.close();
+std::vector<std::string> SSTable::block_boundaries() const {
+    std::vector<std::string> keys;
+    keys.reserve(index_.size());
+    for (const auto& e : index_) keys.push_back(e.key);
+    return keys;
+}
 
-    fsync_file(tmp);
-    std::filesystem::rename(tmp, final_path);
-    fsync_file(final_path);
+size_t SSTable::filter_bytes() const {
+    if (!filter_ok_) return 0;
+    return filter_type_ == FilterType::kBinaryFuse ? fuse_.memory_bytes() : bloom_.m_bits() / 8;
+}
 
-    // Write bloom sidecar atomically too
-    const std::string bloom_path = bloom_path_for(final_path);
-    const std::string bloom_tmp = bloom_path + ".tmp";
-    bloom.save(bloom_tmp);
-    fsync_file(bloom_tmp);
-    std::filesystem::rename(bloom_tmp, bloom_path);
-    fsync_file(bloom_path);
+bool SSTable::may_contain_prefix(const std::string& extractor_name, std::string_view prefix,
+                                 uint64_t hash) const {
+    if (prefix_extractor_name_.empty() || prefix_extractor_name_ != extractor_name) return true;
+    return prefix_bloom_.possibly_contains(prefix, hash);
 }
 
 std::optional<std::optional<std::string>> SSTable::get(const std::string& key) const {
-    if (!valid_ || index_.empty()) return std::nullopt;
+    return get(key, key_hash::value(key));
+}
 
-    // Bloom fast negative
-    if (bloom_ok_ && !bloom_.possibly_contains(key)) {
+std::optional<std::optional<std::string>> SSTable::get(const std::string& key, uint64_t hash) const {
+    // A table with a bad block is treated like one that failed to open.
+    if (!valid_ || index_.empty() || corrupted()) return std::nullopt;
+
+    // filter fast negative
+    if (filter_ok_ && !(filter_type_ == FilterType::kBinaryFuse ? fuse_.possibly_contains(hash)
+                                                                 : bloom_.possibly_contains(key, hash))) {
         return std::nullopt;
     }
 
-    auto it = std::upper_bound(
+    // first block whose last key >= key
+    auto it = std::lower_bound(
         index_.begin(), index_.end(), key,
-        [](const std::string& k, const IndexEntry& e) { return k < e.key; }
+        [](const IndexEntry& e, const std::string& k) { return e.key < k; }
     );
+    if (it == index_.end()) return std::nullopt;
 
-    uint64_t start = (it == index_.begin()) ? index_.front().offset : (--it)->offset;
+    auto block = read_block(*it);
+    if (!block) return std::nullopt;
+    return block->get(key);
+}
 
-    uint64_t off = start;
-    while (true) {
-        std::string k;
-        std::optional<std::string> v;
-        uint64_t next = 0;
+SSTable::Iterator::Iterator(const SSTable& table, bool fill_cache)
+    : table_(table), fill_cache_(fill_cache)
+{
+    if (table_.valid_) load_entry();
+}
+
+void SSTable::Iterator::next() {
+    entry_idx_++;
+    load_entry();
+}
 
-        if (!read_record_at(off, k, v, next)) break;
-        if (k == key) return v;
-        if (k > key) return std::nullopt;
-        off = next;
+void SSTable::Iterator::seek(const std::string& target) {
+    valid_ = false;
+    if (!table_.valid_ || corrupted_) return;
+
+    // first block whose last key >= target, then the entry within it
+    const auto& index = table_.index_;
+    auto it = std::lower_bound(
+        index.begin(), index.end(), target,
+        [](const IndexEntry& e, const std::string& k) { return e.key < k; }
+    );
+    block_idx_ = static_cast<size_t>(it - index.begin());
+    entry_idx_ = 0;
+    block_.reset();
+    if (block_idx_ == index.size()) return;
+
+    block_ = table_.read_block(*it, fill_cache_);
+    if (!block_) {
+        corrupted_ = true;
+        return;
+    }
+    entry_idx_ = block_->lower_bound(target);
+    load_entry();
+}
+
+void SSTable::Iterator::load_entry() {
+    valid_ = false;
+    while (block_idx_ < table_.index_.size()) {
+        if (!block_) {
+            block_ = table_.read_block(table_.index_[block_idx_], fill_cache_);
+            if (!block_) {
+                corrupted_ = true;
+                return;
+            }
+        }
+
+        std::string_view k;
+        std::optional<std::string_view> v;
+        if (entry_idx_ < block_->num_entries()) {
+            if (!block_->entry(entry_idx_, k, v)) {
+                corrupted_ = true;
+                return;
+            }
+            key_.assign(k);
+            if (v) value_ = std::string(*v);
+            else value_ = std::nullopt;
+            valid_ = true;
+            return;
+        }
+        block_idx_++;
+        entry_idx_ = 0;
+        block_.reset();
     }
-    return std::nullopt;
 }
@@ -0,0 +1,54 @@
+#include "thread_pool.hpp"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(int high_threads, int low_threads) {
+    const int counts[2] = {std::max(high_threads, 1), std::max(low_threads, 1)};
+    for (int p = 0; p < 2; ++p) {
+        Lane& lane = lanes_[p];
+        for (int i = 0; i < counts[p]; ++i) {
+            lane.threads.emplace_back([this, &lane] { run_(lane); });
+        }
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    shutdown();
+}
+
+void ThreadPool::schedule(std::function<void()> job, Priority pri) {
+    Lane& lane = lanes_[pri == Priority::kHigh ? 0 : 1];
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (stop_) return;
+        lane.queue.push_back(std::move(job));
+    }
+    lane.cv.notify_one();
+}
+
+void ThreadPool::shutdown() {
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        if (stop_) return;
+        stop_ = true;
+        for (Lane& lane : lanes_) lane.queue.clear();
+    }
+    for (Lane& lane : lanes_) {
+        lane.cv.notify_all();
+        for (auto& t : lane.threads) t.join();
+    }
+}
+
+void ThreadPool::run_(Lane& lane) {
+    std::unique_lock<std::mutex> lk(mu_);
+    while (true) {
+        lane.cv.wait(lk, [&] { return stop_ || !lane.queue.empty(); });
+        if (stop_) return;
+
+        auto job = std::move(lane.queue.front());
+        lane.queue.pop_front();
+        lk.unlock();
+        job();
+        lk.lock();
+    }
+}
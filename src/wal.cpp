@@ -1,16 +1,23 @@
 #include "wal.hpp"
 #include "db.hpp"
+#include "write_batch.hpp"
+#include "manifest.hpp"
 
 #include <filesystem>
 #include <fstream>
-#include <vector>
-#include <cstring>
+#include <stdexcept>
+#include <cerrno>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 namespace {
 #pragma pack(push, 1)
 struct WalHeader {
     uint32_t total_len;   // header+payload+checksum
-    uint8_t  type;        // 1=put, 2=del
+    uint8_t  type;        // 1=put, 2=del, 3=batch (ksize 0, value = batch rep)
     uint32_t ksize;
     uint32_t vsize;       // 0 for delete
     uint32_t checksum;    // FNV-1a over (type,ksize,vsize,key,value)
@@ -21,15 +28,23 @@ struct WalHeader {
 WAL::WAL(const std::string& path)
     : path_(path)
 {
-    out_.open(path_, std::ios::binary | std::ios::app);
+#if defined(__unix__) || defined(__APPLE__)
+    fd_ = ::open(path_.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+#endif
+    if (fd_ < 0) throw std::runtime_error("Failed to open WAL: " + path_);
+
+    // a synced record is only durable if the segment's name is too
+    const std::string dir = std::filesystem::path(path_).parent_path().string();
+    sync_dir(dir.empty() ? "." : dir);
 }
 
 WAL::~WAL() {
-    if (out_.is_open()) out_.close();
+#if defined(__unix__) || defined(__APPLE__)
+    if (fd_ >= 0) ::close(fd_);
+#endif
 }
 
-uint32_t WAL::fnv1a_32(const uint8_t* data, size_t n) {
-    uint32_t h = 2166136261u;
+uint32_t WAL::fnv1a_32(const uint8_t* data, size_t n, uint32_t h) {
     for (size_t i = 0; i < n; ++i) {
         h ^= data[i];
         h *= 16777619u;
@@ -37,55 +52,88 @@ uint32_t WAL::fnv1a_32(const uint8_t* data, size_t n) {
     return h;
 }
 
-void WAL::append_record(uint8_t type, const std::string& key, const std::string* value) {
+uint32_t WAL::record_checksum(uint8_t type, const std::string& key, const std::string* value) {
+    // FNV-1a over [type][ksize][vsize][key][value]
     const uint32_t ksize = static_cast<uint32_t>(key.size());
     const uint32_t vsize = value ? static_cast<uint32_t>(value->size()) : 0u;
 
-    // compute checksum over a contiguous buffer: [type][ksize][vsize][key][value]
-    std::vector<uint8_t> buf;
-    buf.reserve(1 + sizeof(uint32_t) + sizeof(uint32_t) + ksize + vsize);
-
-    buf.push_back(type);
-
-    auto push_u32 = [&](uint32_t x) {
-        uint8_t b[4];
-        std::memcpy(b, &x, 4);
-        buf.insert(buf.end(), b, b + 4);
-    };
-
-    push_u32(ksize);
-    push_u32(vsize);
-    buf.insert(buf.end(), reinterpret_cast<const uint8_t*>(key.data()),
-               reinterpret_cast<const uint8_t*>(key.data()) + ksize);
-    if (value && vsize) {
-        buf.insert(buf.end(),
-                   reinterpret_cast<const uint8_t*>(value->data()),
-                   reinterpret_cast<const uint8_t*>(value->data()) + vsize);
-    }
+    uint32_t h = fnv1a_32(&type, 1);
+    h = fnv1a_32(reinterpret_cast<const uint8_t*>(&ksize), 4, h);
+    h = fnv1a_32(reinterpret_cast<const uint8_t*>(&vsize), 4, h);
+    h = fnv1a_32(reinterpret_cast<const uint8_t*>(key.data()), ksize, h);
+    if (value) h = fnv1a_32(reinterpret_cast<const uint8_t*>(value->data()), vsize, h);
+    return h;
+}
+
+void WAL::encode_record(std::string& dst, uint8_t type, const std::string& key,
+                        const std::string* value) {
+    const uint32_t ksize = static_cast<uint32_t>(key.size());
+    const uint32_t vsize = value ? static_cast<uint32_t>(value->size()) : 0u;
 
     WalHeader hdr{};
     hdr.type = type;
     hdr.ksize = ksize;
     hdr.vsize = vsize;
-    hdr.checksum = fnv1a_32(buf.data(), buf.size());
+    hdr.checksum = record_checksum(type, key, value);
     hdr.total_len = static_cast<uint32_t>(sizeof(WalHeader) + ksize + vsize);
 
-    out_.write(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
-    out_.write(key.data(), ksize);
-    if (value && vsize) out_.write(value->data(), vsize);
-    out_.flush();
+    dst.append(reinterpret_cast<const char*>(&hdr), sizeof(hdr));
+    dst.append(key);
+    if (value) dst.append(*value);
+}
+
+void WAL::encode_put(std::string& dst, const std::string& key, const std::string& value) {
+    encode_record(dst, 1, key, &value);
+}
+
+void WAL::encode_delete(std::string& dst, const std::string& key) {
+    encode_record(dst, 2, key, nullptr);
+}
+
+void WAL::encode_batch(std::string& dst, const WriteBatch& batch) {
+    static const std::string kEmpty;
+    encode_record(dst, 3, kEmpty, &batch.rep_);
 }
 
-void WAL::append_put(const std::string& key, const std::string& value) {
-    append_record(1, key, &value);
+void WAL::add_records(const std::string& buf, bool sync) {
+    if (failed_) throw std::runtime_error("WAL failed earlier: " + path_);
+#if defined(__unix__) || defined(__APPLE__)
+    const char* p = buf.data();
+    size_t left = buf.size();
+    while (left > 0) {
+        ssize_t r = ::write(fd_, p, left);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) {
+            failed_ = true; // a torn record would hide everything after it
+            throw std::runtime_error("WAL write failed: " + path_);
+        }
+        p += r;
+        left -= static_cast<size_t>(r);
+    }
+#else
+    (void)buf;
+#endif
+    if (sync) this->sync();
 }
 
-void WAL::append_delete(const std::string& key) {
-    append_record(2, key, nullptr);
+void WAL::sync() {
+    if (failed_) throw std::runtime_error("WAL failed earlier: " + path_);
+    int r = 0;
+#if defined(__APPLE__)
+    r = ::fsync(fd_);
+#elif defined(__unix__)
+    r = ::fdatasync(fd_);
+#endif
+    if (r != 0) {
+        // The kernel may have dropped the dirty pages it could not write,
+        // so a later sync succeeding would prove nothing.
+        failed_ = true;
+        throw std::runtime_error("WAL sync failed: " + path_);
+    }
 }
 
-void WAL::replay(HeliosDB& db) {
-    std::ifstream in(path_, std::ios::binary);
+void WAL::replay(const std::string& path, HeliosDB& db) {
+    std::ifstream in(path, std::ios::binary);
     if (!in.is_open()) return;
 
     while (true) {
@@ -95,7 +143,7 @@ void WAL::replay(HeliosDB& db) {
 
         // Basic sanity checks to prevent insane allocations on corruption
         if (hdr.total_len < sizeof(WalHeader)) break;
-        if (hdr.type != 1 && hdr.type != 2) break;
+        if (hdr.type < 1 || hdr.type > 3) break;
         if (hdr.type == 2 && hdr.vsize != 0) break;
 
         // Ensure remaining bytes are available; if not, tail is partial => stop safely
@@ -107,47 +155,34 @@ void WAL::replay(HeliosDB& db) {
         if (!in) break;
 
         std::string value;
-        if (hdr.type == 1) {
+        if (hdr.type != 2) {
             value.assign(hdr.vsize, '\0');
             in.read(value.data(), hdr.vsize);
             if (!in) break;
         }
 
         // recompute checksum
-        std::vector<uint8_t> buf;
-        buf.reserve(1 + 8 + hdr.ksize + hdr.vsize);
-        buf.push_back(hdr.type);
-
-        auto push_u32 = [&](uint32_t x) {
-            uint8_t b[4];
-            std::memcpy(b, &x, 4);
-            buf.insert(buf.end(), b, b + 4);
-        };
-
-        push_u32(hdr.ksize);
-        push_u32(hdr.vsize);
-        buf.insert(buf.end(),
-                   reinterpret_cast<const uint8_t*>(key.data()),
-                   reinterpret_cast<const uint8_t*>(key.data()) + hdr.ksize);
-        if (hdr.type == 1 && hdr.vsize) {
-            buf.insert(buf.end(),
-                       reinterpret_cast<const uint8_t*>(value.data()),
-                       reinterpret_cast<const uint8_t*>(value.data()) + hdr.vsize);
-        }
-
-        const uint32_t chk = fnv1a_32(buf.data(), buf.size());
+        const uint32_t chk = record_checksum(hdr.type, key, hdr.type != 2 ? &value : nullptr);
         if (chk != hdr.checksum) {
             // Corrupt record x stop safely ,do NOT apply garbage
             break;
         }
 
-        if (hdr.type == 1) db.apply_put(key, value);
-        else db.apply_delete(key);
+        if (hdr.type == 3) {
+            // validate the whole batch before applying any of it
+            WriteBatch batch;
+            batch.rep_ = std::move(value);
+            size_t n = 0;
+            if (!batch.iterate([&](const std::string&, const std::string*) { n++; })) break;
+            batch.count_ = n;
+            batch.iterate([&](const std::string& k, const std::string* v) {
+                if (v) db.apply_put(k, *v);
+                else db.apply_delete(k);
+            });
+        } else if (hdr.type == 1) {
+            db.apply_put(key, value);
+        } else {
+            db.apply_delete(key);
+        }
     }
 }
-
-void WAL::reset() {
-    out_.close();
-    std::filesystem::remove(path_);
-    out_.open(path_, std::ios::binary | std::ios::app);
-}
\ No newline at end of file
@@ -0,0 +1,58 @@
+#include "write_batch.hpp"
+
+#include <cstring>
+
+void WriteBatch::append_op(uint8_t type, const std::string& key, const std::string* value) {
+    const uint32_t ksize = static_cast<uint32_t>(key.size());
+    const uint32_t vsize = value ? static_cast<uint32_t>(value->size()) : 0u;
+
+    rep_.push_back(static_cast<char>(type));
+    rep_.append(reinterpret_cast<const char*>(&ksize), 4);
+    rep_.append(reinterpret_cast<const char*>(&vsize), 4);
+    rep_.append(key);
+    if (value) rep_.append(*value);
+    count_++;
+}
+
+void WriteBatch::put(const std::string& key, const std::string& value) {
+    append_op(1, key, &value);
+}
+
+void WriteBatch::del(const std::string& key) {
+    append_op(2, key, nullptr);
+}
+
+void WriteBatch::clear() {
+    rep_.clear();
+    count_ = 0;
+}
+
+bool WriteBatch::iterate(
+    const std::function<void(const std::string&, const std::string*)>& fn) const {
+    size_t off = 0;
+    std::string key, value;
+    while (off < rep_.size()) {
+        if (rep_.size() - off < 9) return false;
+
+        const uint8_t type = static_cast<uint8_t>(rep_[off]);
+        uint32_t ksize = 0, vsize = 0;
+        std::memcpy(&ksize, rep_.data() + off + 1, 4);
+        std::memcpy(&vsize, rep_.data() + off + 5, 4);
+        off += 9;
+
+        if (type != 1 && type != 2) return false;
+        if (type == 2 && vsize != 0) return false;
+        if (rep_.size() - off < static_cast<uint64_t>(ksize) + vsize) return false;
+
+        key.assign(rep_, off, ksize);
+        off += ksize;
+        if (type == 1) {
+            value.assign(rep_, off, vsize);
+            off += vsize;
+            fn(key, &value);
+        } else {
+            fn(key, nullptr);
+        }
+    }
+    return true;
+}
@@ -1,7 +1,15 @@
 #include "db.hpp"
+#include "write_batch.hpp"
+#include <algorithm>
 #include <cassert>
+#include <csignal>
 #include <filesystem>
 #include <fstream>
+#include <thread>
+#include <vector>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
 
 int main() {
     const std::string dir = "data_test";
@@ -40,6 +48,245 @@ int main() {
         }
     }
 
+    // Unflushed writes across several memtable switches survive a reopen
+    std::filesystem::remove_all(dir);
+    {
+        HeliosDB db(dir);
+        for (int i = 0; i < 60000; i++) {
+            db.put("w" + std::to_string(i), std::string(40, 'a' + i % 26));
+        }
+        db.del("w7");
+    }
+    {
+        HeliosDB db(dir);
+        for (int i = 0; i < 60000; i++) {
+            auto v = db.get("w" + std::to_string(i));
+            if (i == 7) { assert(!v.has_value()); continue; }
+            assert(v.has_value());
+            assert(v.value() == std::string(40, 'a' + i % 26));
+        }
+    }
+
+    // Concurrent put/del/write: followers queue behind a leader that logs
+    // the whole group with one append. Every acked write survives a reopen.
+    std::filesystem::remove_all(dir);
+    {
+        Options synced;
+        synced.wal_mode = WalMode::kSync; // slow appends let groups form
+        constexpr int kThreads = 8, kOps = 300;
+        {
+            HeliosDB db(dir, synced);
+            std::vector<std::thread> writers;
+            for (int t = 0; t < kThreads; t++) {
+                writers.emplace_back([&db, t] {
+                    const std::string p = "g" + std::to_string(t) + "_";
+                    for (int i = 0; i < kOps; i++) {
+                        const std::string k = p + std::to_string(i);
+                        if (i % 3 == 0) {
+                            WriteBatch b;
+                            b.put(k, "batch");
+                            b.del(p + std::to_string(i - 1)); // deleted already
+                            db.write(b);
+                        } else if (i % 3 == 1) {
+                            db.put(k, "put");
+                        } else {
+                            db.put(k, "doomed");
+                            db.del(k);
+                        }
+                    }
+                });
+            }
+            for (auto& w : writers) w.join();
+
+            const DBStats s = db.stats();
+            assert(s.wal_group_writes == kThreads * (kOps / 3) * 4);
+            assert(s.wal_groups < s.wal_group_writes); // some groups had followers
+        }
+        HeliosDB db(dir, synced);
+        for (int t = 0; t < kThreads; t++) {
+            for (int i = 0; i < kOps; i++) {
+                const auto v = db.get("g" + std::to_string(t) + "_" + std::to_string(i));
+                if (i % 3 == 0) assert(v == "batch");
+                if (i % 3 == 1) assert(v == "put");
+                if (i % 3 == 2) assert(!v.has_value());
+            }
+        }
+    }
+
+    // Each open flushes what it recovered from the WAL and deletes the old
+    // segments, so they don't pile up and get replayed again and again
+    std::filesystem::remove_all(dir);
+    [[maybe_unused]] auto wal_segments = [&] {
+        size_t n = 0;
+        for (const auto& e : std::filesystem::directory_iterator(dir)) {
+            n += e.path().filename().string().starts_with("wal_");
+        }
+        return n;
+    };
+    for (int reopen = 0; reopen < 20; reopen++) {
+        HeliosDB db(dir);
+        assert(wal_segments() == 1);
+        for (int i = 0; i < reopen; i++) assert(db.get("r" + std::to_string(i)) == std::to_string(i));
+        db.put("r" + std::to_string(reopen), std::to_string(reopen));
+    }
+
+    // Every WAL mode keeps acked writes across a clean close; writes that
+    // skipped the WAL only live in memory, so close() flushes them. A copy
+    // of the directory taken while the DB is open is what a process crash
+    // would leave: it has the logged writes and not the others.
+    const std::string crashed = dir + "_crashed";
+    for (WalMode mode : {WalMode::kSync, WalMode::kPeriodic, WalMode::kBuffered, WalMode::kDisabled}) {
+        std::filesystem::remove_all(dir);
+        std::filesystem::remove_all(crashed);
+        Options o;
+        o.wal_mode = mode;
+        WriteOptions synced, unlogged;
+        synced.sync = true;
+        unlogged.disable_wal = true;
+        {
+            HeliosDB db(dir, o);
+            db.put("a", "1");
+            db.put("b", "2", synced);
+            db.del("a", synced);
+            db.put("c", "3", unlogged);
+            std::filesystem::copy(dir, crashed);
+        }
+        {
+            HeliosDB db(dir, o);
+            assert(!db.get("a").has_value());
+            assert(db.get("b") == "2");
+            assert(db.get("c") == "3");
+        }
+        {
+            HeliosDB db(crashed, o);
+            [[maybe_unused]] const bool logged = mode != WalMode::kDisabled;
+            assert(db.get("b").has_value() == logged);
+            assert(!db.get("a").has_value());
+            assert(!db.get("c").has_value());
+        }
+    }
+    std::filesystem::remove_all(crashed);
+
+    // A manifest.txt from before the edit log is migrated; a small
+    // max_manifest_file_size rolls the log over many times
+    std::filesystem::remove_all(dir);
+    Options small;
+    small.max_manifest_file_size = 256;
+    {
+        HeliosDB db(dir, small);
+        for (int f = 0; f < 8; f++) {
+            for (int i = 0; i < 100; i++) db.put("m" + std::to_string(i), "v" + std::to_string(f));
+            db.flush();
+        }
+    }
+    std::vector<std::string> tables;
+    for (const auto& e : std::filesystem::directory_iterator(dir)) {
+        const std::string f = e.path().filename().string();
+        if (f.starts_with("sst_")) tables.push_back(f);
+        if (f.starts_with("MANIFEST-") || f == "CURRENT") std::filesystem::remove(e.path());
+    }
+    std::sort(tables.begin(), tables.end());
+    {
+        std::ofstream out(dir + "/manifest.txt");
+        for (const auto& f : tables) out << f << " 0\n";
+    }
+    for (int reopen = 0; reopen < 2; reopen++) {
+        HeliosDB db(dir, small);
+        assert(!std::filesystem::exists(dir + "/manifest.txt"));
+        for (int i = 0; i < 100; i++) assert(db.get("m" + std::to_string(i)) == "v7");
+    }
+
+    // Prefix scans: every flush spans a..z, but only one holds each tenant,
+    // so the per-table prefix filters skip the others
+    std::filesystem::remove_all(dir);
+    Options prefixed;
+    prefixed.prefix_delimiter_count = 1;
+    prefixed.level0_file_num_compaction_trigger = 8; // keep the four tables apart
+    {
+        HeliosDB db(dir, prefixed);
+        for (int f = 0; f < 4; f++) {
+            for (int i = 0; i < 50; i++) {
+                db.put("a:" + std::to_string(i), "v" + std::to_string(f));
+                db.put("t" + std::to_string(f) + ":" + std::to_string(i), "v" + std::to_string(f));
+            }
+            db.put("z:", "end");
+            db.flush();
+        }
+        db.del("t2:7");
+        db.put("t2:7x", "mem");
+
+        auto rows = db.scan_prefix("t2:");
+        assert(rows.size() == 50);
+        assert(std::is_sorted(rows.begin(), rows.end()));
+        for ([[maybe_unused]] const auto& [k, v] : rows) {
+            assert(k.starts_with("t2:") && k != "t2:7");
+            assert(v == (k == "t2:7x" ? "mem" : "v2"));
+        }
+        assert(db.stats().prefix_scan_tables_skipped >= 3);
+
+        // no full prefix: only key ranges can rule tables out
+        assert(db.scan_prefix("t").size() == 4 * 50);
+        assert(db.scan_prefix("a:").size() == 50 && db.scan_prefix("a:")[0].second == "v3");
+        assert(db.scan_prefix("q:").empty());
+    }
+
+    // A scan that hits a corrupt block throws rather than returning a
+    // silently short result
+    for (const auto& e : std::filesystem::directory_iterator(dir)) {
+        if (!e.path().filename().string().starts_with("sst_")) continue;
+        std::fstream f(e.path(), std::ios::in | std::ios::out | std::ios::binary);
+        f.seekp(100);
+        f.put('\x7f');
+    }
+    {
+        HeliosDB db(dir, prefixed);
+        [[maybe_unused]] bool threw = false;
+        try {
+            db.scan_prefix("a:");
+        } catch (const std::runtime_error&) {
+            threw = true;
+        }
+        assert(threw);
+    }
+
+#if defined(__unix__) || defined(__APPLE__)
+    // A WAL append that fails (here the file size limit cuts it short) is
+    // recorded as the background error, and later writes throw it rather
+    // than appending after a torn record. Every acked write is recovered.
+    std::filesystem::remove_all(dir);
+    {
+        std::signal(SIGXFSZ, SIG_IGN);
+        rlimit saved{};
+        getrlimit(RLIMIT_FSIZE, &saved);
+        Options synced;
+        synced.wal_mode = WalMode::kSync;
+        int acked = 0;
+        {
+            HeliosDB db(dir, synced);
+            rlimit small_files = saved;
+            small_files.rlim_cur = 64 << 10;
+            setrlimit(RLIMIT_FSIZE, &small_files);
+            try {
+                for (; acked < 100000; acked++) db.put("f" + std::to_string(acked), std::string(100, 'f'));
+            } catch (const std::runtime_error&) {
+            }
+            setrlimit(RLIMIT_FSIZE, &saved);
+            assert(acked > 0 && acked < 100000);
+            assert(!db.stats().background_error.empty());
+            [[maybe_unused]] bool threw = false;
+            try {
+                db.put("after", "x");
+            } catch (const std::runtime_error&) {
+                threw = true;
+            }
+            assert(threw);
+        }
+        HeliosDB db(dir, synced);
+        for (int i = 0; i < acked; i++) assert(db.get("f" + std::to_string(i)) == std::string(100, 'f'));
+        assert(!db.get("after").has_value());
+    }
+#endif
+
     std::filesystem::remove_all(dir);
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,329 @@
+#include "db.hpp"
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Small limits so a few flushes push data down several levels.
+static Options small_options() {
+    Options o;
+    o.num_levels = 4;
+    o.level0_file_num_compaction_trigger = 2;
+    o.max_bytes_for_level_base = 128 << 10;
+    o.max_bytes_for_level_multiplier = 4;
+    o.target_file_size = 32 << 10;
+    o.max_subcompactions = 4;
+    o.max_background_flushes = 2;
+    o.max_background_compactions = 3;
+    return o;
+}
+
+static size_t total_files(HeliosDB& db) {
+    size_t n = 0;
+    for (size_t f : db.stats().files_per_level) n += f;
+    return n;
+}
+
+static void wait_for_compactions(HeliosDB& db, const Options& o) {
+    for (int i = 0; i < 1000; i++) {
+        if (db.stats().files_per_level[0] < static_cast<size_t>(o.level0_file_num_compaction_trigger)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            return;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    assert(false && "compaction did not catch up");
+}
+
+int main() {
+    const std::string dir = "data_compaction_test";
+    std::filesystem::remove_all(dir);
+    const Options opts = small_options();
+
+    std::map<std::string, std::optional<std::string>> model;
+    std::mt19937 rng(42);
+
+    auto check = [&]([[maybe_unused]] HeliosDB& db) {
+        for ([[maybe_unused]] const auto& [k, v] : model) assert(db.get(k) == v);
+        assert(!db.get("missing").has_value());
+    };
+
+    {
+        HeliosDB db(dir, opts);
+        for (int round = 0; round < 12; round++) {
+            for (int i = 0; i < 2000; i++) {
+                const std::string k = "key" + std::to_string(rng() % 8000);
+                if (rng() % 10 == 0) {
+                    db.del(k);
+                    model[k] = std::nullopt;
+                } else {
+                    const std::string v = std::string(40, 'a' + round) + std::to_string(i);
+                    db.put(k, v);
+                    model[k] = v;
+                }
+            }
+            db.flush();
+        }
+        wait_for_compactions(db, opts);
+
+        const DBStats s = db.stats();
+        assert(s.files_per_level.size() == 4);
+        assert(s.compactions > 0);
+        size_t deeper = 0;
+        for (size_t l = 1; l < s.files_per_level.size(); l++) deeper += s.files_per_level[l];
+        assert(deeper > 1); // output was split at target_file_size
+        check(db);
+    }
+
+    // levels are recorded in the manifest
+    {
+        HeliosDB db(dir, opts);
+        const DBStats s = db.stats();
+        assert(s.files_per_level[0] < 2);
+        check(db);
+    }
+
+    // Deleting everything: tombstones reach the bottom and are dropped
+    // there, taking the data they shadow with them
+    {
+        HeliosDB db(dir, opts);
+        for (auto& [k, v] : model) {
+            db.del(k);
+            v = std::nullopt;
+        }
+        db.flush();
+        for (int i = 0; i < 1000 && total_files(db) > 0; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        assert(total_files(db) == 0);
+        check(db);
+    }
+
+    // Readers on several threads, beside flushes, compactions and memtable
+    // switches, always find what was there before they started. Tables the
+    // compactions replaced are deleted once no view holds them any more.
+    std::filesystem::remove_all(dir);
+    {
+        HeliosDB db(dir, opts);
+        for (int i = 0; i < 4000; i++) db.put("key" + std::to_string(i), "v0");
+        db.flush();
+
+        std::atomic<bool> done{false};
+        std::atomic<uint64_t> reads{0};
+        std::vector<std::thread> readers;
+        for (int t = 0; t < 4; t++) {
+            readers.emplace_back([&, t] {
+                std::mt19937 r(t);
+                while (!done.load()) {
+                    auto v = db.get("key" + std::to_string(r() % 4000));
+                    assert(v.has_value() && v->starts_with("v"));
+                    reads++;
+                }
+            });
+        }
+        for (int round = 1; round <= 8; round++) {
+            for (int i = 0; i < 4000; i++) {
+                db.put("key" + std::to_string(i), "v" + std::to_string(round) + std::string(40, 'x'));
+            }
+            db.flush();
+        }
+        wait_for_compactions(db, opts);
+        done = true;
+        for (auto& t : readers) t.join();
+        assert(reads.load() > 0);
+        assert(db.stats().compactions > 0);
+
+        auto files_on_disk = [&] {
+            size_t n = 0;
+            for (const auto& e : std::filesystem::directory_iterator(dir)) {
+                n += e.path().filename().string().starts_with("sst_");
+            }
+            return n;
+        };
+        for (int i = 0; i < 500 && files_on_disk() != total_files(db); i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        assert(files_on_disk() == total_files(db));
+        for (int i = 0; i < 4000; i++) assert(db.get("key" + std::to_string(i))->starts_with("v8"));
+    }
+
+    // One L0 -> L1 compaction of several target_file_size worth of input
+    // is cut into max_subcompactions key ranges, merged side by side
+    std::filesystem::remove_all(dir);
+    model.clear();
+    Options popts = small_options();
+    popts.level0_file_num_compaction_trigger = 4;
+    popts.max_bytes_for_level_base = 64 << 20; // nothing goes past L1
+    {
+        HeliosDB db(dir, popts);
+        for (int round = 0; round < 4; round++) {
+            for (int i = 0; i < 2000; i++) {
+                const std::string k = "key" + std::to_string(rng() % 8000);
+                const std::string v = std::string(40, 'a' + round) + std::to_string(i);
+                db.put(k, v);
+                model[k] = v;
+            }
+            db.flush();
+        }
+        wait_for_compactions(db, popts);
+
+        const DBStats s = db.stats();
+        assert(s.compactions == 1);
+        assert(s.subcompactions == popts.max_subcompactions);
+        assert(s.files_per_level[0] == 0 && s.files_per_level[1] >= popts.max_subcompactions);
+        check(db);
+    }
+    {
+        HeliosDB db(dir, popts);
+        check(db);
+    }
+
+    // Universal: everything stays in L0 as sorted runs, merged until there
+    // are fewer than the trigger
+    std::filesystem::remove_all(dir);
+    model.clear();
+    Options uopts = small_options();
+    uopts.compaction_style = CompactionStyle::kUniversal;
+    uopts.level0_file_num_compaction_trigger = 4;
+    {
+        HeliosDB db(dir, uopts);
+        for (int round = 0; round < 12; round++) {
+            for (int i = 0; i < 2000; i++) {
+                const std::string k = "key" + std::to_string(rng() % 8000);
+                const std::string v = std::to_string(round) + ":" + std::to_string(i);
+                db.put(k, v);
+                model[k] = v;
+            }
+            db.flush();
+        }
+        wait_for_compactions(db, uopts);
+
+        const DBStats s = db.stats();
+        assert(s.compactions > 0);
+        assert(s.files_per_level[0] > 0 && s.files_per_level[0] < 4);
+        for (size_t l = 1; l < s.files_per_level.size(); l++) assert(s.files_per_level[l] == 0);
+        check(db);
+    }
+    {
+        HeliosDB db(dir, uopts);
+        check(db);
+
+        // a deletion-heavy run is merged down to the oldest one at once
+        for (auto& [k, v] : model) {
+            db.del(k);
+            v = std::nullopt;
+        }
+        db.flush();
+        for (int i = 0; i < 1000 && total_files(db) > 0; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        assert(total_files(db) == 0);
+        check(db);
+    }
+
+    // Write controller: any L0 table slows writes down, a few stop them
+    // until compaction catches up. Filters stay near their memory budget.
+    std::filesystem::remove_all(dir);
+    model.clear();
+    Options sopts = small_options();
+    sopts.level0_slowdown_writes_trigger = 1;
+    sopts.level0_stop_writes_trigger = 3;
+    sopts.delayed_write_rate = 8 << 20;
+    sopts.filter_memory_budget = 4 << 10; // ~4 bits/key
+    {
+        HeliosDB db(dir, sopts);
+        for (int round = 0; round < 6; round++) {
+            for (int i = 0; i < 2000; i++) {
+                const std::string k = "key" + std::to_string(rng() % 8000);
+                const std::string v = std::to_string(round) + ":" + std::to_string(i);
+                db.put(k, v);
+                model[k] = v;
+            }
+            db.flush();
+        }
+        wait_for_compactions(db, sopts);
+
+        const DBStats s = db.stats();
+        assert(s.write_slowdown_micros > 0);
+        assert(s.filter_bytes > 0 && s.filter_bytes < 2 * sopts.filter_memory_budget);
+        check(db);
+    }
+
+    // A failed flush (its tmp file is a directory here) is reported, not
+    // fatal. The error sticks and later writes throw it; the memtable is
+    // still read from memory and recovered from the WAL on reopen.
+    std::filesystem::remove_all(dir);
+    for (int id = 1; id <= 4; id++) {
+        std::filesystem::create_directories(dir + "/sst_00000" + std::to_string(id) + ".dat.tmp/x");
+    }
+    [[maybe_unused]] auto throws = [](auto&& f) {
+        try {
+            f();
+        } catch (const std::runtime_error&) {
+            return true;
+        }
+        return false;
+    };
+    {
+        HeliosDB db(dir, opts);
+        db.put("a", "1");
+        assert(throws([&] { db.flush(); }));
+        assert(!db.stats().background_error.empty());
+        assert(throws([&] { db.put("b", "2"); }));
+        assert(db.get("a") == "1");
+    }
+    for (int id = 1; id <= 4; id++) {
+        std::filesystem::remove_all(dir + "/sst_00000" + std::to_string(id) + ".dat.tmp");
+    }
+    {
+        HeliosDB db(dir, opts);
+        assert(db.stats().background_error.empty());
+        assert(db.get("a") == "1");
+        assert(!db.get("b").has_value());
+    }
+
+    // An L0 table that fails a block checksum in compaction is dropped, as
+    // background_verify would, so L0 drains and stopped writes go on
+    std::filesystem::remove_all(dir);
+    Options copts = small_options();
+    copts.level0_file_num_compaction_trigger = 100;
+    {
+        HeliosDB db(dir, copts);
+        for (int round = 0; round < 2; round++) {
+            for (int i = 0; i < 2000; i++) db.put("old" + std::to_string(i), std::to_string(round));
+            db.flush();
+        }
+    }
+    for (const auto& e : std::filesystem::directory_iterator(dir)) {
+        if (!e.path().filename().string().starts_with("sst_")) continue;
+        std::fstream f(e.path(), std::ios::in | std::ios::out | std::ios::binary);
+        f.seekp(100);
+        f.put('\x7f');
+    }
+    copts = small_options();
+    copts.level0_stop_writes_trigger = 5;
+    {
+        HeliosDB db(dir, copts);
+        for (int round = 0; round < 8; round++) {
+            for (int i = 0; i < 2000; i++) db.put("new" + std::to_string(i), std::to_string(round));
+            db.flush();
+        }
+        wait_for_compactions(db, copts);
+
+        const DBStats s = db.stats();
+        assert(s.background_error.empty());
+        assert(s.compaction_failures > 0);
+        assert(s.compactions > 0);
+        for (int i = 0; i < 2000; i++) assert(db.get("new" + std::to_string(i)) == "7");
+    }
+
+    std::filesystem::remove_all(dir);
+    return 0;
+}
@@ -0,0 +1,49 @@
+#include "memtable.hpp"
+#include <atomic>
+#include <cassert>
+#include <string>
+#include <thread>
+#include <vector>
+
+int main() {
+    MemTable mem;
+    std::atomic<uint64_t> seq{0};
+
+    // Concurrent writers, each overwriting its own keys twice
+    const int kThreads = 8;
+    const int kKeys = 2000;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; t++) {
+        threads.emplace_back([&, t] {
+            for (int round = 0; round < 2; round++) {
+                for (int i = 0; i < kKeys; i++) {
+                    std::string k = "k" + std::to_string(t) + "_" + std::to_string(i);
+                    if (round == 1 && i % 3 == 0) mem.add(++seq, k, std::nullopt);
+                    else mem.add(++seq, k, "v" + std::to_string(round));
+                }
+            }
+        });
+    }
+    for (auto& th : threads) th.join();
+
+    for (int t = 0; t < kThreads; t++) {
+        for (int i = 0; i < kKeys; i++) {
+            auto v = mem.get("k" + std::to_string(t) + "_" + std::to_string(i));
+            assert(v.has_value());
+            if (i % 3 == 0) assert(!v->has_value());
+            else assert(v->value() == "v1");
+        }
+    }
+    assert(!mem.get("missing").has_value());
+
+    // Iterator yields each key once, newest version, in order
+    size_t n = 0;
+    std::string prev;
+    for (MemTable::Iterator it(mem); it.valid(); it.next()) {
+        assert(n == 0 || prev < it.key());
+        prev = it.key();
+        n++;
+    }
+    assert(n == static_cast<size_t>(kThreads * kKeys));
+    return 0;
+}
@@ -0,0 +1,72 @@
+#include "rate_limiter.hpp"
+#include <cassert>
+#include <chrono>
+#include <thread>
+
+using Clock = std::chrono::steady_clock;
+
+[[maybe_unused]] static double seconds_since(Clock::time_point t) {
+    return std::chrono::duration<double>(Clock::now() - t).count();
+}
+
+int main() {
+    // low priority requests are held to the rate
+    {
+        RateLimiter rl(1 << 20);
+        [[maybe_unused]] const auto start = Clock::now();
+        for (int i = 0; i < 64; i++) rl.request(4096, RateLimiter::Priority::kLow);
+        assert(seconds_since(start) >= 0.2);
+    }
+
+    // high priority requests never wait, but leave debt behind: the low
+    // priority request after it pays for both. Only the ratio is checked,
+    // so a loaded machine doesn't fail it.
+    {
+        RateLimiter rl(1 << 20);
+        const auto start = Clock::now();
+        rl.request(512 << 10, RateLimiter::Priority::kHigh);
+        [[maybe_unused]] const double high = seconds_since(start);
+        rl.request(4096, RateLimiter::Priority::kLow);
+        [[maybe_unused]] const double both = seconds_since(start);
+        assert(both >= 0.4);
+        assert(high < both / 4);
+    }
+
+    // changing the rate wakes waiters; 0 is unlimited. The waiter owes
+    // over a minute at the old rate.
+    {
+        RateLimiter rl(1024);
+        rl.request(64 << 10, RateLimiter::Priority::kHigh);
+        std::thread t([&] { rl.request(4096, RateLimiter::Priority::kLow); });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        [[maybe_unused]] const auto start = Clock::now();
+        rl.set_bytes_per_second(0);
+        t.join();
+        assert(seconds_since(start) < 30);
+        assert(rl.bytes_per_second() == 0);
+    }
+
+    // auto-tune backs off while reads are slow and recovers after
+    {
+        RateLimiter rl(64 << 20, true);
+        for (int i = 0; i < 100; i++) rl.record_read_latency(100);
+        std::this_thread::sleep_for(RateLimiter::kTunePeriod);
+        rl.request(1, RateLimiter::Priority::kLow);
+        assert(rl.bytes_per_second() == 64 << 20);
+
+        for (int round = 0; round < 5; round++) {
+            for (int i = 0; i < 100; i++) rl.record_read_latency(1000);
+            std::this_thread::sleep_for(RateLimiter::kTunePeriod);
+            rl.request(1, RateLimiter::Priority::kLow);
+        }
+        [[maybe_unused]] const uint64_t slowed = rl.bytes_per_second();
+        assert(slowed < 64 << 20);
+
+        for (int round = 0; round < 5; round++) {
+            std::this_thread::sleep_for(RateLimiter::kTunePeriod);
+            rl.request(1, RateLimiter::Priority::kLow);
+        }
+        assert(rl.bytes_per_second() > slowed);
+    }
+    return 0;
+}
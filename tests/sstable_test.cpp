@@ -0,0 +1,317 @@
+#include "sstable.hpp"
+#include "bloom.hpp"
+#include "cache.hpp"
+#include "merging_iterator.hpp"
+#include "db.hpp"
+#include <cassert>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// The filter layouts of older tables, written the way their writers did,
+// for checking that they still decode.
+static uint64_t legacy_hash(const std::string& key, uint64_t seed) {
+    uint64_t f = 1469598103934665603ULL; // FNV-1a
+    for (unsigned char c : key) {
+        f ^= c;
+        f *= 1099511628211ULL;
+    }
+    uint64_t h = seed ^ f;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static std::string legacy_filter(uint32_t magic, uint32_t m, uint32_t k, const std::string& bits) {
+    const uint32_t nbytes = static_cast<uint32_t>(bits.size());
+    std::string out;
+    for (uint32_t v : {magic, m, k, nbytes}) out.append(reinterpret_cast<const char*>(&v), 4);
+    return out + bits;
+}
+
+// bits spread over the whole array by double hashing (format v1 sidecars
+// and v2 tables)
+static std::string whole_array_filter(const std::vector<std::string>& keys, uint32_t m, uint32_t k) {
+    std::string bits((m + 7) / 8, '\0');
+    for (const auto& key : keys) {
+        const uint64_t h1 = legacy_hash(key, 0xA5A5A5A5A5A5A5A5ULL);
+        const uint64_t h2 = legacy_hash(key, 0x5A5A5A5A5A5A5A5AULL) | 1;
+        for (uint32_t i = 0; i < k; i++) {
+            const uint32_t bit = static_cast<uint32_t>((h1 + i * h2) % m);
+            bits[bit / 8] |= static_cast<char>(1 << (bit % 8));
+        }
+    }
+    return legacy_filter(0xB100B100u, m, k, bits);
+}
+
+// one 512-bit block per key, picked from FNV-1a
+static std::string blocked_fnv_filter(const std::vector<std::string>& keys, uint32_t m, uint32_t k) {
+    m = (m + 511) / 512 * 512;
+    std::string bits(m / 8, '\0');
+    for (const auto& key : keys) {
+        const uint64_t h = legacy_hash(key, 0xA5A5A5A5A5A5A5A5ULL);
+        const uint64_t block = (h >> 32) * (m / 512) >> 32;
+        uint32_t a = static_cast<uint32_t>(h);
+        for (uint32_t i = 0; i < k; i++) {
+            const uint64_t bit = block * 512 + (a >> 23);
+            bits[bit / 8] |= static_cast<char>(1 << (bit % 8));
+            a *= 0x9e3779b9u;
+        }
+    }
+    return legacy_filter(0xB100B101u, m, k, bits);
+}
+
+int main() {
+    const std::string dir = "data_sstable_test";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    const std::string path = dir + "/t.dat";
+
+    std::vector<std::pair<std::string, std::optional<std::string>>> entries;
+    for (int i = 0; i < 20000; i++) {
+        std::string k = "key" + std::to_string(100000 + i);
+        if (i % 10 == 0) entries.push_back({k, std::nullopt});
+        else entries.push_back({k, "value" + std::to_string(i)});
+    }
+    SSTable::write_atomic(path, entries);
+
+    // Point lookups, tombstones and properties
+    {
+        assert(SSTable::is_valid(path));
+        SSTable t(path);
+        assert(t.valid());
+        assert(t.num_entries() == entries.size());
+        assert(t.num_deletions() == 2000);
+        assert(t.smallest() == entries.front().first);
+        assert(t.largest() == entries.back().first);
+
+        for (size_t i = 0; i < entries.size(); i += 7) {
+            auto v = t.get(entries[i].first);
+            assert(v.has_value());
+            assert(*v == entries[i].second);
+        }
+        assert(!t.get("key0").has_value());
+        assert(!t.get("zzz").has_value());
+
+        size_t n = 0;
+        for (SSTable::Iterator it(t); it.valid(); it.next()) {
+            assert(it.key() == entries[n].first);
+            n++;
+        }
+        assert(n == entries.size());
+
+        SSTable::Iterator it(t);
+        it.seek("key105000");
+        assert(it.valid() && it.key() == "key105000");
+        it.seek("key105000a"); // between keys
+        assert(it.valid() && it.key() == "key105001");
+        it.seek("");
+        assert(it.valid() && it.key() == entries.front().first);
+        it.seek("zzz");
+        assert(!it.valid());
+    }
+
+    // Repeat lookups are served from the block cache; usage stays bounded
+    {
+        BlockCache cache(64 << 10);
+        SSTable t(path, &cache, 1);
+        assert(t.get(entries[1].first) == entries[1].second);
+        assert(cache.hits() == 0 && cache.misses() == 1);
+        assert(t.get(entries[2].first) == entries[2].second); // same block
+        assert(cache.hits() == 1);
+
+        for (size_t i = 0; i < entries.size(); i += 3) {
+            auto v = t.get(entries[i].first);
+            assert(v.has_value() && *v == entries[i].second);
+        }
+        assert(cache.usage() <= cache.capacity());
+
+        // scans use cached blocks but do not fill the cache
+        SSTable cold(path, &cache, 2);
+        size_t n = 0;
+        for (SSTable::Iterator it(cold); it.valid(); it.next()) n++;
+        assert(n == entries.size());
+        [[maybe_unused]] const uint64_t misses = cache.misses();
+        assert(cold.get(entries[1].first) == entries[1].second);
+        assert(cache.misses() == misses + 1);
+    }
+
+    // Merging two tables: the newer one wins on equal keys, tombstones kept
+    {
+        const std::string newer = dir + "/newer.dat";
+        {
+            SSTable::Builder b(newer, 3);
+            b.add("key100001", std::string("new"));
+            b.add("key100002", std::nullopt);
+            b.add("zzz", std::string("tail"));
+            b.finish();
+        }
+        SSTable a(newer), b(path);
+        std::vector<std::unique_ptr<KVIterator>> children;
+        children.push_back(std::make_unique<SSTable::Iterator>(a));
+        children.push_back(std::make_unique<SSTable::Iterator>(b));
+        MergingIterator it(std::move(children));
+
+        size_t n = 0;
+        std::string prev;
+        for (; it.valid(); it.next(), n++) {
+            assert(n == 0 || prev < it.key());
+            prev = it.key();
+            if (it.key() == "key100001") assert(it.value() == "new");
+            if (it.key() == "key100002") assert(!it.value().has_value());
+        }
+        assert(n == entries.size() + 1);
+        assert(prev == "zzz");
+        assert(!it.corrupted());
+    }
+
+    // A binary fuse filter finds every key and rejects nearly all others
+    {
+        const std::string fuse = dir + "/fuse.dat";
+        {
+            SSTable::Builder b(fuse, entries.size(), FilterType::kBinaryFuse);
+            for (const auto& [k, v] : entries) b.add(k, v);
+            b.finish();
+        }
+        BlockCache cache(1 << 20);
+        SSTable t(fuse, &cache, 3);
+        assert(t.valid());
+        for (const auto& [k, v] : entries) {
+            auto got = t.get(k);
+            assert(got.has_value() && *got == v);
+        }
+        // each key the filter lets through costs a block lookup
+        [[maybe_unused]] const uint64_t lookups = cache.misses() + cache.hits();
+        for (int i = 0; i < 2000; i++) assert(!t.get("key" + std::to_string(100000 + i) + "x"));
+        assert(cache.misses() + cache.hits() - lookups < 40); // ~0.4% of 2000
+    }
+
+    // A table a compaction replaced is only marked obsolete: it stays
+    // readable for whoever still holds it, such as a reader's old view,
+    // and its file goes with the last reference
+    {
+        const std::string old = dir + "/old.dat";
+        SSTable::write_atomic(old, {{"k", std::string("v")}});
+        auto version = std::make_shared<SSTable>(old);
+        auto reader = version;
+        version->mark_obsolete();
+        version.reset();
+        assert(std::filesystem::exists(old));
+        auto got = reader->get("k");
+        assert(got.has_value() && *got == "v");
+        reader.reset();
+        assert(!std::filesystem::exists(old));
+    }
+
+    // Filters in the older layouts still find every key they were built
+    // from, including a whole-array filter in a .bloom sidecar. The current
+    // blocked filter stays near its 0.95% false positive rate at 10 bits/key.
+    {
+        std::vector<std::string> keys;
+        for (int i = 0; i < 10000; i++) keys.push_back("key" + std::to_string(i));
+        [[maybe_unused]] auto false_positives = [](const BloomFilter& f) {
+            int n = 0;
+            for (int i = 0; i < 100000; i++) n += f.possibly_contains("absent" + std::to_string(i));
+            return n;
+        };
+
+        bool ok = false;
+        const std::string legacy[] = {whole_array_filter(keys, 100000, 7),
+                                      blocked_fnv_filter(keys, 100000, 7)};
+        for (const auto& block : legacy) {
+            BloomFilter f = BloomFilter::decode(block, ok);
+            assert(ok);
+            for ([[maybe_unused]] const auto& k : keys) assert(f.possibly_contains(k));
+            assert(false_positives(f) < 2000);
+        }
+
+        const std::string sidecar = dir + "/v1.dat.bloom";
+        std::ofstream(sidecar, std::ios::binary) << whole_array_filter(keys, 100000, 7);
+        BloomFilter f = BloomFilter::load(sidecar, ok);
+        assert(ok);
+        for ([[maybe_unused]] const auto& k : keys) assert(f.possibly_contains(k));
+
+        BloomFilter blocked(static_cast<uint32_t>(keys.size()) * 10, 7);
+        for (const auto& k : keys) blocked.add(k);
+        for ([[maybe_unused]] const auto& k : keys) assert(blocked.possibly_contains(k));
+        assert(false_positives(blocked) < 1500); // < 1.5%
+    }
+
+    // A flat table from before the block format, with its .bloom sidecar
+    // and named by a manifest.txt, is rewritten in the current format when
+    // the DB opens, and later flushes don't reuse its file name
+    {
+        const std::string db_dir = dir + "/legacy_db";
+        const std::string flat = db_dir + "/sst_000001.dat";
+        std::filesystem::create_directories(db_dir);
+
+        std::vector<std::string> keys;
+        std::string records;
+        for (int i = 0; i < 200; i++) {
+            char key[16];
+            std::snprintf(key, sizeof(key), "legacy%03d", i);
+            keys.push_back(key);
+            const std::string value = "v" + std::to_string(i);
+            const uint32_t ksize = static_cast<uint32_t>(keys.back().size());
+            const uint32_t vsize = i % 10 == 0 ? kTombstoneVSize : static_cast<uint32_t>(value.size());
+            records.append(reinterpret_cast<const char*>(&ksize), 4);
+            records.append(reinterpret_cast<const char*>(&vsize), 4);
+            records += keys.back();
+            if (vsize != kTombstoneVSize) records += value;
+        }
+        const uint64_t magic = 0x48454C494F535354ULL; // "HELIOSST"
+        uint32_t checksum = 2166136261u; // FNV-1a over the records
+        for (unsigned char c : records) {
+            checksum ^= c;
+            checksum *= 16777619u;
+        }
+        {
+            std::ofstream out(flat, std::ios::binary);
+            out << records;
+            out.write(reinterpret_cast<const char*>(&magic), 8);
+            out.write(reinterpret_cast<const char*>(&checksum), 4);
+        }
+        std::ofstream(flat + ".bloom", std::ios::binary) << whole_array_filter(keys, 2000, 7);
+        std::ofstream(db_dir + "/manifest.txt") << "sst_000001.dat 0\n";
+
+        auto check = [&]([[maybe_unused]] HeliosDB& db) {
+            for (int i = 0; i < 200; i++) {
+                [[maybe_unused]] const auto v = db.get(keys[i]);
+                assert(i % 10 == 0 ? !v.has_value() : v == "v" + std::to_string(i));
+            }
+        };
+        {
+            HeliosDB db(db_dir);
+            check(db);
+            assert(!std::filesystem::exists(flat + ".bloom"));
+            assert(SSTable(flat).format_version() == 3);
+            db.put("after", "upgrade");
+            db.flush();
+        }
+        HeliosDB db(db_dir);
+        check(db);
+        assert(db.get("after") == "upgrade");
+    }
+
+    // A flipped byte in a data block is caught when that block is read
+    {
+        std::fstream f(path, std::ios::in | std::ios::out | std::ios::binary);
+        f.seekp(100);
+        f.put('\x7f');
+    }
+    {
+        SSTable t(path); // footer and meta blocks are intact
+        assert(t.valid());
+        assert(!t.get(entries[1].first).has_value());
+        assert(t.corrupted());
+        assert(!SSTable::is_valid(path));
+    }
+
+    std::filesystem::remove_all(dir);
+    return 0;
+}
@@ -0,0 +1,70 @@
+#include "db.hpp"
+#include "write_batch.hpp"
+#include <cassert>
+#include <filesystem>
+#include <string>
+
+int main() {
+    const std::string dir = "data_batch_test";
+    std::filesystem::remove_all(dir);
+
+    // Batches are recovered from the WAL as a whole
+    {
+        HeliosDB db(dir);
+        db.put("k0", "old");
+
+        WriteBatch b;
+        for (int i = 0; i < 1000; i++) b.put("k" + std::to_string(i), "v" + std::to_string(i));
+        b.del("k0");
+        assert(b.count() == 1001);
+        db.write(b);
+
+        assert(!db.get("k0").has_value());
+        assert(db.get("k999").value() == "v999");
+    }
+    {
+        HeliosDB db(dir);
+        assert(!db.get("k0").has_value());
+        for (int i = 1; i < 1000; i++) {
+            assert(db.get("k" + std::to_string(i)).value() == "v" + std::to_string(i));
+        }
+    }
+
+    // A torn batch record applies none of its ops
+    std::filesystem::remove_all(dir);
+    {
+        HeliosDB db(dir);
+        db.put("before", "x");
+        WriteBatch b;
+        b.put("a", "1");
+        b.put("b", "2");
+        db.write(b);
+    }
+    for (const auto& e : std::filesystem::directory_iterator(dir)) {
+        if (e.path().extension() == ".log" && std::filesystem::file_size(e.path()) > 0) {
+            std::filesystem::resize_file(e.path(), std::filesystem::file_size(e.path()) - 3);
+        }
+    }
+    {
+        HeliosDB db(dir);
+        assert(db.get("before").value() == "x");
+        assert(!db.get("a").has_value());
+        assert(!db.get("b").has_value());
+    }
+
+    // Without a WAL, a clean close still persists the memtable
+    std::filesystem::remove_all(dir);
+    {
+        Options opts;
+        opts.wal_mode = WalMode::kDisabled;
+        HeliosDB db(dir, opts);
+        db.put("bulk", "loaded");
+    }
+    {
+        HeliosDB db(dir);
+        assert(db.get("bulk").value() == "loaded");
+    }
+
+    std::filesystem::remove_all(dir);
+    return 0;
+}